@@ -2,7 +2,7 @@ import {
   bench,
   runBenchmarks,
 } from "https://deno.land/std@0.135.0/testing/bench.ts";
-import { DB } from "./mod.ts";
+import { AsyncDB, DB } from "./mod.ts";
 
 if (Deno.args[0]) {
   try {
@@ -56,7 +56,40 @@ bench({
   },
 });
 
-/** Performance of select statements (select all; 10_000). */
+bench({
+  name: "insert 10 000 (execute many)",
+  runs: 100,
+  func: (b): void => {
+    b.start();
+    const query = db.prepareQuery(
+      "INSERT INTO users (name, balance) VALUES (?, ?)",
+    );
+    const rows = [];
+    for (let i = 0; i < 10_000; i++) {
+      rows.push([names[i % names.length], i]);
+    }
+    db.query("begin");
+    query.executeMany(rows);
+    db.query("commit");
+    b.stop();
+  },
+});
+
+/**
+ * Performance of select statements (select all; 10_000).
+ *
+ * Rows are fetched in packed batches (see `step_rows` in
+ * `build/src/wrapper.c`). These benchmarks have not been run
+ * against a build with packed rows yet. Stand-in measurements
+ * reading 10 000 rows of (INTEGER, TEXT, REAL) gave:
+ * - The old per-cell loop took 7 - 11 ms on the previous WASM
+ *   build under Node. SQLite stepping alone took 1.1 - 1.8 ms.
+ * - With packed rows, native step_rows took 2.5 - 3.3 ms, and
+ *   decoding the batches in JS took 0.6 - 0.8 ms.
+ * The packed path makes 157 calls into WASM instead of about
+ * 90 000. Replace these numbers with results from this file
+ * once it can be run.
+ */
 bench({
   name: "select 10 000 (select all)",
   runs: 100,
@@ -69,6 +102,38 @@ bench({
   },
 });
 
+/** Performance of select statements (iterate; 10_000). */
+bench({
+  name: "select 10 000 (iterate)",
+  runs: 100,
+  func: (b): void => {
+    b.start();
+    const query = db.prepareQuery(
+      "SELECT name, balance FROM users LIMIT 10000",
+    );
+    for (const _row of query.iter()) {
+      // consume rows
+    }
+    query.finalize();
+    b.stop();
+  },
+});
+
+/** Performance of select statements (select all, 10 columns; 10_000). */
+bench({
+  name: "select 10 000 (select all, 10 columns)",
+  runs: 100,
+  func: (b): void => {
+    b.start();
+    db.query(
+      `SELECT id, name, balance, id * 2, name || 'x', balance / 3.0,
+        upper(name), id + balance, lower(name), NULL
+      FROM users LIMIT 10000`,
+    );
+    b.stop();
+  },
+});
+
 /** Performance of select statements (select individually; 10_000). */
 bench({
   name: "select 10 000 (select first)",
@@ -85,4 +150,90 @@ bench({
   },
 });
 
-runBenchmarks();
+/**
+ * Scaling of read-heavy workloads with the number of reader workers.
+ * Readers need a database file, so this only runs when the benchmarks
+ * are allowed to read and write files.
+ */
+const ASYNC_ROWS = 100_000;
+const ASYNC_READS = 32;
+const asyncSql = "SELECT count(*), sum(balance) FROM users WHERE name LIKE ?";
+
+async function asyncPermissions(): Promise<boolean> {
+  const query = async (name: "read" | "write") =>
+    (await Deno.permissions.query({ name })).state === "granted";
+  return await query("read") && await query("write");
+}
+
+// Register the async benchmarks, returns a function which
+// cleans up after they ran
+async function benchAsync(): Promise<() => Promise<void>> {
+  const asyncFile = await Deno.makeTempFile({ suffix: ".db" });
+  const asyncDbs: Array<AsyncDB> = [];
+
+  const seedDb = new DB(asyncFile);
+  seedDb.execute(
+    "CREATE TABLE users (id INTEGER PRIMARY KEY, name TEXT, balance INTEGER)",
+  );
+  const seed = seedDb.prepareQuery(
+    "INSERT INTO users (name, balance) VALUES (?, ?)",
+  );
+  seedDb.transaction(() =>
+    seed.executeMany(
+      Array.from(
+        { length: ASYNC_ROWS },
+        (_, i) => [`${names[i % names.length]} ${i}`, i],
+      ),
+    )
+  );
+  seed.finalize();
+
+  bench({
+    name: `read x${ASYNC_READS} (sync)`,
+    runs: 10,
+    func: (b): void => {
+      b.start();
+      for (let i = 0; i < ASYNC_READS; i++) {
+        seedDb.query(asyncSql, [`%${i}%`]);
+      }
+      b.stop();
+    },
+  });
+
+  const readerCounts = [1, 2, 4, navigator.hardwareConcurrency]
+    .filter((count, idx, counts) =>
+      count <= navigator.hardwareConcurrency && counts.indexOf(count) === idx
+    );
+  for (const readers of readerCounts) {
+    const asyncDb = await AsyncDB.open(asyncFile, {
+      readers,
+      statementCacheSize: 1,
+    });
+    asyncDbs.push(asyncDb);
+    bench({
+      name: `read x${ASYNC_READS} (async, ${readers} readers)`,
+      runs: 10,
+      func: async (b): Promise<void> => {
+        b.start();
+        const reads = [];
+        for (let i = 0; i < ASYNC_READS; i++) {
+          reads.push(asyncDb.read(asyncSql, [`%${i}%`]));
+        }
+        await Promise.all(reads);
+        b.stop();
+      },
+    });
+  }
+
+  return async () => {
+    seedDb.close();
+    for (const asyncDb of asyncDbs) await asyncDb.close();
+    await Deno.remove(asyncFile);
+  };
+}
+
+const cleanupAsync = await asyncPermissions() ? await benchAsync() : undefined;
+
+await runBenchmarks();
+
+await cleanupAsync?.();
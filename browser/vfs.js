@@ -194,6 +194,9 @@ export default function env(inst) {
     js_time: () => {
       return Date.now();
     },
+    js_now: () => {
+      return performance.now();
+    },
     js_timezone: () => {
       return (new Date()).getTimezoneOffset();
     },
@@ -14,6 +14,7 @@ enum Type {
   VoidPtr,
   StringPtr,
   StatementPtr,
+  BlobPtr,
   Double,
   Int,
 }
@@ -37,7 +38,7 @@ const wrapperSrc = await Deno.readTextFile(src);
 
 // int EXPORT(bind_int) (sqlite3_stmt* stmt, int idx, double value)
 const typeRegexp =
-  `(const +)?(sqlite3_stmt\\*|char\\*|void\\*|int|uint32_t|double|void)`;
+  `(const +)?(sqlite3_stmt\\*|sqlite3_blob\\*|char\\*|void\\*|int|uint32_t|double|void)`;
 const argRegexp = `${typeRegexp} +[a-z_]+`;
 const exportSignature = new RegExp(
   `${typeRegexp} +EXPORT\\([a-z_]+\\) +\\(((${argRegexp}( *, *${argRegexp})*)|)\\)`,
@@ -61,6 +62,8 @@ function typeFromCType(cType: string): Type {
       return Type.StringPtr;
     case "sqlite3_stmt*":
       return Type.StatementPtr;
+    case "sqlite3_blob*":
+      return Type.BlobPtr;
     case "double":
       return Type.Double;
     case "int":
@@ -108,6 +111,8 @@ function generateType(tp: Type): string {
       return "StringPtr";
     case Type.StatementPtr:
       return "StatementPtr";
+    case Type.BlobPtr:
+      return "BlobPtr";
     case Type.Int:
     case Type.Double:
       return "number";
@@ -141,6 +146,7 @@ const typeDeclaration =
 export type VoidPtr = number;
 export type StringPtr = number;
 export type StatementPtr = number;
+export type BlobPtr = number;
 
 export interface Wasm {
   memory: WebAssembly.Memory;
@@ -150,7 +156,7 @@ export interface Wasm {
 
 export function compile(): Promise<void>;
 export function instantiateBrowser(): Promise<void>;
-export function instantiate(): { exports: Wasm, functions: Array<(argc: number) => void> };
+export function instantiate(): { exports: Wasm, functions: Array<(call: number, state: number, argc: number, args: VoidPtr) => void> };
 `;
 
 await Deno.writeTextFile(dest, typeDeclaration);
@@ -0,0 +1,303 @@
+// Native benchmark of the C layer (`src/wrapper.c` and `src/vfs.c`),
+// run with `make bench`. The WASM imports are provided by
+// `native_imports.c`, so this measures everything except the cost
+// of crossing into JS. It can be run under perf to profile the
+// wrapper and the VFS.
+//
+// Usage: ./native_bench [rows]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sqlite3.h>
+#include <pcg.h>
+#include "native_imports.h"
+
+#define BENCH_DB_FILE "native_bench.db"
+#define TEST_DB_FILE "2GB_test.db"
+
+#define DEFAULT_ROWS 100000
+#define INSERT_BATCH 1000
+#define LOOKUP_OPS 20000
+#define SCAN_OPS 2000
+#define SCAN_ROWS 100
+#define FTS_OPS 2000
+#define TEST_DB_OPS 2000
+#define TEST_DB_ROWS 45000
+
+#define VOCAB_SIZE 2048
+#define WORDS_PER_ROW 12
+#define STEP_BATCH 64
+
+#define OPEN_FLAGS (SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE)
+
+// Exports from `src/wrapper.c`, where `open` and `close` are
+// renamed to not clash with libc (see the Makefile)
+extern int           wrapper_open(const char* filename, int flags);
+extern int           wrapper_close();
+extern int           get_status();
+extern const char*   get_sqlite_error_str();
+extern void          seed_rng(double seed);
+extern int           exec(const char* sql);
+extern sqlite3_stmt* prepare(const char* sql);
+extern int           finalize(sqlite3_stmt* stmt);
+extern int           reset(sqlite3_stmt* stmt);
+extern int           bind_int(sqlite3_stmt* stmt, int idx, double value);
+extern int           bind_text(sqlite3_stmt* stmt, int idx, const char* value);
+extern int           step_rows(sqlite3_stmt* stmt, int max_rows);
+extern int           execute_batch(sqlite3_stmt* stmt, const void* batch, int rows);
+
+// Latencies of the operations of one benchmark
+typedef struct Bench Bench;
+struct Bench {
+  const char* name;
+  double* latencies;
+  int ops;
+  int capacity;
+  double started;
+  long calls[NATIVE_CALL_KINDS];
+};
+
+char vocab[VOCAB_SIZE][9];
+
+double now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void fail(const char* what) {
+  fprintf(stderr, "%s failed (status %i): %s\n", what, get_status(), get_sqlite_error_str());
+  exit(1);
+}
+
+void bench_start(Bench* bench, const char* name, int capacity) {
+  bench->name = name;
+  bench->latencies = malloc(sizeof(double) * capacity);
+  bench->ops = 0;
+  bench->capacity = capacity;
+  memcpy(bench->calls, native_calls, sizeof(native_calls));
+  bench->started = now_ns();
+}
+
+void bench_record(Bench* bench, double started) {
+  if (bench->ops < bench->capacity)
+    bench->latencies[bench->ops ++] = now_ns() - started;
+}
+
+int compare_latency(const void* a, const void* b) {
+  double diff = *(const double*)a - *(const double*)b;
+  return (diff > 0) - (diff < 0);
+}
+
+// Print p50/ p99 latency, throughput and the number
+// of VFS imports called per operation
+void bench_report(Bench* bench) {
+  double total = now_ns() - bench->started;
+  if (bench->ops == 0) {
+    free(bench->latencies);
+    return;
+  }
+  qsort(bench->latencies, bench->ops, sizeof(double), compare_latency);
+  double p50 = bench->latencies[(int)(bench->ops * 0.50)];
+  double p99 = bench->latencies[(int)(bench->ops * 0.99)];
+
+  double per_op[NATIVE_CALL_KINDS];
+  for (int i = 0; i < NATIVE_CALL_KINDS; i ++)
+    per_op[i] = (double)(native_calls[i] - bench->calls[i]) / bench->ops;
+
+  printf("%-30s %8i ops %10.2f us p50 %10.2f us p99 %12.0f ops/s   ",
+         bench->name, bench->ops, p50 / 1e3, p99 / 1e3, bench->ops / (total / 1e9));
+  printf("read %.2f write %.2f sync %.2f size %.2f lock %.2f\n",
+         per_op[NATIVE_CALL_READ], per_op[NATIVE_CALL_WRITE], per_op[NATIVE_CALL_SYNC],
+         per_op[NATIVE_CALL_SIZE], per_op[NATIVE_CALL_LOCK]);
+  free(bench->latencies);
+}
+
+void gen_vocab() {
+  char charset[] = "abcdefghijklmnopqrstuvwxyz";
+  for (int i = 0; i < VOCAB_SIZE; i ++) {
+    int length = 3 + pcg_rand() % 6;
+    for (int j = 0; j < length; j ++)
+      vocab[i][j] = charset[pcg_rand() % (sizeof charset - 1)];
+    vocab[i][length] = '\0';
+  }
+}
+
+// Append a parameter set for `INSERT INTO bench (num, body)` to the
+// buffer, using the format expected by `execute_batch`
+unsigned char* put_row(unsigned char* cursor) {
+  uint32_t params = 2;
+  memcpy(cursor, &params, 4);
+  cursor += 4;
+
+  double num = (double)pcg_rand();
+  *cursor++ = SQLITE_INTEGER;
+  memcpy(cursor, &num, 8);
+  cursor += 8;
+
+  char body[WORDS_PER_ROW * 9];
+  uint32_t len = 0;
+  for (int i = 0; i < WORDS_PER_ROW; i ++) {
+    const char* word = vocab[pcg_rand() % VOCAB_SIZE];
+    size_t word_len = strlen(word);
+    memcpy(&body[len], word, word_len);
+    len += word_len;
+    body[len ++] = ' ';
+  }
+  len --;
+  *cursor++ = SQLITE_TEXT;
+  memcpy(cursor, &len, 4);
+  cursor += 4;
+  memcpy(cursor, body, len);
+  return cursor + len;
+}
+
+// Run the statement to completion, fetching rows the
+// same way `PreparedQuery.all` does
+int fetch_all(sqlite3_stmt* stmt) {
+  int rows = 0;
+  do {
+    rows += step_rows(stmt, STEP_BATCH);
+  } while (get_status() == SQLITE_ROW);
+  if (get_status() != SQLITE_DONE)
+    fail("step_rows");
+  reset(stmt);
+  return rows;
+}
+
+void bench_insert(int rows) {
+  Bench bench;
+  bench_start(&bench, "insert (1000 row batches)", rows / INSERT_BATCH + 1);
+
+  sqlite3_stmt* stmt = prepare("INSERT INTO bench (num, body) VALUES (?, ?)");
+  if (!stmt) fail("prepare");
+  unsigned char* batch = malloc(INSERT_BATCH * (4 + 9 + 5 + WORDS_PER_ROW * 9));
+  for (int done = 0; done < rows; done += INSERT_BATCH) {
+    int count = rows - done < INSERT_BATCH ? rows - done : INSERT_BATCH;
+    unsigned char* cursor = batch;
+    for (int i = 0; i < count; i ++)
+      cursor = put_row(cursor);
+
+    double started = now_ns();
+    if (exec("BEGIN") != SQLITE_OK) fail("begin");
+    if (execute_batch(stmt, batch, count) != count) fail("execute_batch");
+    if (exec("COMMIT") != SQLITE_OK) fail("commit");
+    bench_record(&bench, started);
+  }
+  free(batch);
+  finalize(stmt);
+  bench_report(&bench);
+}
+
+void bench_point_lookup(int rows) {
+  Bench bench;
+  bench_start(&bench, "point lookup", LOOKUP_OPS);
+
+  sqlite3_stmt* stmt = prepare("SELECT num, body FROM bench WHERE id = ?");
+  if (!stmt) fail("prepare");
+  for (int i = 0; i < LOOKUP_OPS; i ++) {
+    double started = now_ns();
+    bind_int(stmt, 1, 1 + pcg_rand() % rows);
+    if (fetch_all(stmt) != 1) fail("point lookup");
+    bench_record(&bench, started);
+  }
+  finalize(stmt);
+  bench_report(&bench);
+}
+
+void bench_range_scan(int rows) {
+  Bench bench;
+  bench_start(&bench, "range scan (100 rows)", SCAN_OPS);
+
+  sqlite3_stmt* stmt = prepare("SELECT id, num, body FROM bench WHERE id BETWEEN ? AND ?");
+  if (!stmt) fail("prepare");
+  for (int i = 0; i < SCAN_OPS; i ++) {
+    int low = 1 + pcg_rand() % (rows - SCAN_ROWS);
+    double started = now_ns();
+    bind_int(stmt, 1, low);
+    bind_int(stmt, 2, low + SCAN_ROWS - 1);
+    if (fetch_all(stmt) != SCAN_ROWS) fail("range scan");
+    bench_record(&bench, started);
+  }
+  finalize(stmt);
+  bench_report(&bench);
+}
+
+void bench_fts(int rows) {
+  if (exec("CREATE VIRTUAL TABLE bench_fts USING fts5 (body, content=bench, content_rowid=id)") != SQLITE_OK)
+    fail("create fts table");
+  if (exec("INSERT INTO bench_fts (bench_fts) VALUES ('rebuild')") != SQLITE_OK)
+    fail("build fts index");
+
+  Bench bench;
+  bench_start(&bench, "fts5 match (two terms)", FTS_OPS);
+
+  sqlite3_stmt* stmt = prepare("SELECT rowid FROM bench_fts WHERE bench_fts MATCH ? ORDER BY rank LIMIT 10");
+  if (!stmt) fail("prepare");
+  char query[32];
+  for (int i = 0; i < FTS_OPS; i ++) {
+    snprintf(query, sizeof query, "%s OR %s",
+             vocab[pcg_rand() % VOCAB_SIZE], vocab[pcg_rand() % VOCAB_SIZE]);
+    double started = now_ns();
+    bind_text(stmt, 1, query);
+    fetch_all(stmt);
+    bench_record(&bench, started);
+  }
+  finalize(stmt);
+  bench_report(&bench);
+}
+
+// Random lookups of 64KB rows in the database created
+// by `make testdb`, these mostly hit the VFS
+void bench_test_db() {
+  if (access(TEST_DB_FILE, R_OK) != 0) {
+    printf("skipping %s benchmark, run `make testdb` to create it\n", TEST_DB_FILE);
+    return;
+  }
+  if (wrapper_open(TEST_DB_FILE, SQLITE_OPEN_READONLY) != SQLITE_OK) fail("open");
+
+  Bench bench;
+  bench_start(&bench, "2GB db point lookup", TEST_DB_OPS);
+
+  sqlite3_stmt* stmt = prepare("SELECT value FROM test WHERE id = ?");
+  if (!stmt) fail("prepare");
+  for (int i = 0; i < TEST_DB_OPS; i ++) {
+    double started = now_ns();
+    bind_int(stmt, 1, 1 + pcg_rand() % TEST_DB_ROWS);
+    if (fetch_all(stmt) != 1) fail("test db lookup");
+    bench_record(&bench, started);
+  }
+  finalize(stmt);
+  bench_report(&bench);
+
+  if (wrapper_close() != SQLITE_OK) fail("close");
+}
+
+int main(int argc, char** argv) {
+  int rows = argc > 1 ? atoi(argv[1]) : DEFAULT_ROWS;
+  if (rows <= SCAN_ROWS) {
+    fprintf(stderr, "need more than %i rows\n", SCAN_ROWS);
+    return 1;
+  }
+
+  seed_rng(42);
+  gen_vocab();
+  unlink(BENCH_DB_FILE);
+  if (wrapper_open(BENCH_DB_FILE, OPEN_FLAGS) != SQLITE_OK) fail("open");
+  if (exec("CREATE TABLE bench (id INTEGER PRIMARY KEY, num INTEGER, body TEXT)") != SQLITE_OK)
+    fail("create table");
+
+  bench_insert(rows);
+  bench_point_lookup(rows);
+  bench_range_scan(rows);
+  bench_fts(rows);
+
+  if (wrapper_close() != SQLITE_OK) fail("close");
+  unlink(BENCH_DB_FILE);
+
+  bench_test_db();
+  return 0;
+}
@@ -0,0 +1,121 @@
+// Native stand-in for the WASM imports declared in `src/imports.h`,
+// used to benchmark `wrapper.c` and `vfs.c` without Deno. File
+// resource ids are plain POSIX file descriptors.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "native_imports.h"
+
+long native_calls[NATIVE_CALL_KINDS] = { 0 };
+
+void js_print(const char* text) {
+  fputs(text, stderr);
+}
+
+int js_open(const char* path, int mode, int flags) {
+  native_calls[NATIVE_CALL_OPEN] ++;
+  if (mode == 1) {
+    // Temporary files are deleted once closed
+    char temp_path[] = "/tmp/deno_sqliteXXXXXX";
+    int fd = mkstemp(temp_path);
+    unlink(temp_path);
+    return fd;
+  }
+  int open_flags = (flags & 0x00000002) ? O_RDWR : O_RDONLY;
+  if (flags & 0x00000004)
+    open_flags |= O_CREAT;
+  int fd = open(path, open_flags, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "failed to open '%s'\n", path);
+    exit(1);
+  }
+  return fd;
+}
+
+void js_close(int rid) {
+  close(rid);
+}
+
+void js_delete(const char* path) {
+  unlink(path);
+}
+
+int js_read(int rid, const char* buffer, double offset, int amount) {
+  native_calls[NATIVE_CALL_READ] ++;
+  ssize_t read_bytes = pread(rid, (void*)buffer, amount, (off_t)offset);
+  return read_bytes < 0 ? 0 : (int)read_bytes;
+}
+
+int js_write(int rid, const char* buffer, double offset, int amount) {
+  native_calls[NATIVE_CALL_WRITE] ++;
+  ssize_t written = pwrite(rid, buffer, amount, (off_t)offset);
+  return written < 0 ? 0 : (int)written;
+}
+
+void js_truncate(int rid, double size) {
+  native_calls[NATIVE_CALL_TRUNCATE] ++;
+  if (ftruncate(rid, (off_t)size) != 0)
+    fprintf(stderr, "failed to truncate file (rid %i)\n", rid);
+}
+
+void js_sync(int rid) {
+  native_calls[NATIVE_CALL_SYNC] ++;
+  fdatasync(rid);
+}
+
+double js_size(int rid) {
+  native_calls[NATIVE_CALL_SIZE] ++;
+  struct stat st;
+  fstat(rid, &st);
+  return (double)st.st_size;
+}
+
+void js_lock(int rid, int exclusive) {
+  native_calls[NATIVE_CALL_LOCK] ++;
+  flock(rid, exclusive ? LOCK_EX : LOCK_SH);
+}
+
+void js_unlock(int rid) {
+  native_calls[NATIVE_CALL_LOCK] ++;
+  flock(rid, LOCK_UN);
+}
+
+double js_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+double js_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+int js_timezone() {
+  // Same sign as `Date.getTimezoneOffset`. This can't use
+  // localtime_r, which `vfs.c` implements on top of this.
+  time_t now = time(NULL);
+  struct tm utc;
+  gmtime_r(&now, &utc);
+  utc.tm_isdst = -1;
+  return (int)((mktime(&utc) - now) / 60);
+}
+
+int js_exists(const char* path) {
+  return access(path, F_OK) == 0;
+}
+
+int js_access(const char* path) {
+  return access(path, R_OK) == 0;
+}
+
+void js_call_user_func(int func, int call, int state, int argc, const void* args) {
+  fprintf(stderr, "user defined functions are not supported\n");
+  exit(1);
+}
@@ -0,0 +1,18 @@
+#ifndef NATIVE_IMPORTS_H
+#define NATIVE_IMPORTS_H
+
+// Call counters kept by the native implementation
+// of the functions in `src/imports.h`
+
+#define NATIVE_CALL_OPEN     0
+#define NATIVE_CALL_READ     1
+#define NATIVE_CALL_WRITE    2
+#define NATIVE_CALL_TRUNCATE 3
+#define NATIVE_CALL_SYNC     4
+#define NATIVE_CALL_SIZE     5
+#define NATIVE_CALL_LOCK     6
+#define NATIVE_CALL_KINDS    7
+
+extern long native_calls[NATIVE_CALL_KINDS];
+
+#endif // NATIVE_IMPORTS_H
@@ -3,6 +3,7 @@
 export type VoidPtr = number;
 export type StringPtr = number;
 export type StatementPtr = number;
+export type BlobPtr = number;
 
 export interface Wasm {
   memory: WebAssembly.Memory;
@@ -43,6 +44,7 @@ export interface Wasm {
     low: number,
   ) => number;
   bind_null: (stmt: StatementPtr, idx: number) => number;
+  execute_batch: (stmt: StatementPtr, batch: VoidPtr, rows: number) => number;
   bind_parameter_index: (stmt: StatementPtr, name: StringPtr) => number;
   step: (stmt: StatementPtr) => number;
   column_count: (stmt: StatementPtr) => number;
@@ -56,19 +58,22 @@ export interface Wasm {
   column_text: (stmt: StatementPtr, col: number) => StringPtr;
   column_blob: (stmt: StatementPtr, col: number) => VoidPtr;
   column_bytes: (stmt: StatementPtr, col: number) => number;
+  step_rows: (stmt: StatementPtr, max_rows: number) => number;
+  row_buffer: () => VoidPtr;
   create_function: (
     funcname: StringPtr,
     argc: number,
     flags: number,
     func: number,
   ) => number;
-  delete_function: (funcname: StringPtr) => number;
-  argument_type: (arg: number) => number;
-  argument_int: (arg: number) => number;
-  argument_double: (arg: number) => number;
-  argument_text: (arg: number) => StringPtr;
-  argument_blob: (arg: number) => VoidPtr;
-  argument_bytes: (arg: number) => number;
+  create_aggregate: (
+    funcname: StringPtr,
+    argc: number,
+    flags: number,
+    func: number,
+    window: number,
+  ) => number;
+  delete_function: (funcname: StringPtr, argc: number) => number;
   result_int: (value: number) => void;
   result_double: (value: number) => void;
   result_text: (value: StringPtr) => void;
@@ -84,11 +89,30 @@ export interface Wasm {
     bytes: number,
     flags: number,
   ) => number;
+  blob_open: (
+    schema: StringPtr,
+    table: StringPtr,
+    column: StringPtr,
+    row: number,
+    write: number,
+  ) => BlobPtr;
+  blob_reopen: (blob: BlobPtr, row: number) => number;
+  blob_close: (blob: BlobPtr) => number;
+  blob_bytes: (blob: BlobPtr) => number;
+  blob_buffer: () => VoidPtr;
+  blob_buffer_bytes: () => number;
+  blob_read: (blob: BlobPtr, size: number, offset: number) => number;
+  blob_write: (blob: BlobPtr, size: number, offset: number) => number;
+  db_stats: (reset: number) => VoidPtr;
+  set_io_timing: (enabled: number) => void;
+  stmt_stats: (stmt: StatementPtr, reset: number) => VoidPtr;
 }
 
 export function compile(): Promise<void>;
 export function instantiateBrowser(): Promise<void>;
 export function instantiate(): {
   exports: Wasm;
-  functions: Array<(argc: number) => void>;
+  functions: Array<
+    (call: number, state: number, argc: number, args: VoidPtr) => void
+  >;
 };
@@ -15,9 +15,10 @@ extern double js_size(int rid);
 extern void   js_lock(int rid, int exclusive);
 extern void   js_unlock(int rid);
 extern double js_time();
+extern double js_now();
 extern int    js_timezone();
 extern int    js_exists(const char* path);
 extern int    js_access(const char* path);
-extern void   js_call_user_func(int func, int argc);
+extern void   js_call_user_func(int func, int call, int state, int argc, const void* args);
 
 #endif // DEBUG_H
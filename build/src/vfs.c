@@ -5,6 +5,7 @@
 #include <sqlite3.h>
 #include <pcg.h>
 #include "imports.h"
+#include "vfs.h"
 #include "debug.h"
 
 // SQLite VFS component.
@@ -14,6 +15,27 @@
 #define MAXPATHNAME 1024
 #define JS_MAX_SAFE_INTEGER 9007199254740991
 
+// Every call into JS is expensive, so sequential reads are served
+// from a read-ahead block and adjacent writes are merged in a
+// write-behind buffer before they are passed on. Reads which skip
+// at most READ_AHEAD_GAP bytes (e.g. WAL frame headers) still count
+// as sequential.
+#define READ_AHEAD_BYTES 65536
+#define WRITE_BEHIND_BYTES 131072
+#define READ_AHEAD_GAP 64
+#define SECTOR_SIZE 4096
+
+// Calls into JS which access files are counted, and timed if
+// `vfs_timing` is set, see `vfs.h`. Each call is passed as a
+// complete statement.
+#define JS_IO(call) do { \
+                      double __io_start = vfs_timing ? js_now() : 0; \
+                      call; \
+                      if (vfs_timing) \
+                        vfs_stats[VFS_STAT_JS_TIME] += js_now() - __io_start; \
+                      vfs_stats[VFS_STAT_JS_CALLS] += 1; \
+                    } while (0)
+
 // When using this VFS, the sqlite3_file* handles that SQLite uses are
 // actually pointers to instances of type DenoFile.
 typedef struct DenoFile DenoFile;
@@ -21,28 +43,128 @@ struct DenoFile {
   sqlite3_file base;
   // Deno file resource id
   int rid;
+  // Lock currently held on the file
+  int lock;
+  // Cached size of the file, or -1 if unknown
+  sqlite3_int64 size;
+  // Size of chunks the file grows by (set by SQLITE_FCNTL_CHUNK_SIZE)
+  int chunk_size;
+  // Read-ahead block, `read_len` is -1 if the block is not valid
+  char* read_buf;
+  sqlite3_int64 read_ofst;
+  int read_len;
+  // Offset a sequential read would continue at
+  sqlite3_int64 read_next;
+  // WAL-index regions, see `denoShmMap`
+  int shm_count;
+  void** shm_regions;
+  // Whether the file is locked for the WAL-index
+  int shm_locked;
 };
 
+// Writes which have not been passed on to JS yet. Only one file
+// has buffered writes at any time, so writes reach the files in
+// the order SQLite issued them.
+static DenoFile* write_file = NULL;
+static sqlite3_int64 write_ofst = 0;
+static int write_len = 0;
+static char write_buf[WRITE_BEHIND_BYTES];
+
+double vfs_stats[VFS_STAT_COUNT] = { 0 };
+int vfs_timing = 0;
+
+// Write buffered writes to the file.
+static int denoFlush(void) {
+  if (!write_file || write_len == 0) {
+    write_file = NULL;
+    return SQLITE_OK;
+  }
+  int written;
+  JS_IO(written = js_write(write_file->rid, write_buf, (double)write_ofst, write_len));
+  vfs_stats[VFS_STAT_JS_WRITES] += 1;
+  debug_printf("flushing writes (rid %i, amount %i, offset %lli, written %i)\n",
+    write_file->rid, write_len, write_ofst, written);
+  int status = written == write_len ? SQLITE_OK : SQLITE_IOERR_WRITE;
+  write_file = NULL;
+  write_len = 0;
+  return status;
+}
+
+// Forget the read-ahead block and the cached size, e.g.
+// because the file might have been changed by someone else.
+static void denoInvalidate(DenoFile *p) {
+  p->read_len = -1;
+  p->size = -1;
+}
+
+static int denoShmUnmap(sqlite3_file *pFile, int deleteFlag);
+
 static int denoClose(sqlite3_file *pFile) {
   DenoFile* p = (DenoFile*)pFile;
-  js_close(p->rid);
+  int status = write_file == p ? denoFlush() : SQLITE_OK;
+  denoShmUnmap(pFile, 0);
+  sqlite3_free(p->read_buf);
+  JS_IO(js_close(p->rid));
   debug_printf("closing file (rid %i)\n", p->rid);
-  return SQLITE_OK;
+  return status;
+}
+
+// Serve a read from the read-ahead block, if it covers the read. Returns
+// the number of bytes read, or -1 if the block can not be used.
+static int denoReadAhead(DenoFile *p, char *zBuf, int iAmt, sqlite_int64 iOfst) {
+  if (p->read_len < 0 || iOfst < p->read_ofst || iOfst + iAmt > p->read_ofst + READ_AHEAD_BYTES)
+    return -1;
+  // A block shorter than READ_AHEAD_BYTES ends at the end of the file
+  if (iOfst + iAmt > p->read_ofst + p->read_len && p->read_len == READ_AHEAD_BYTES)
+    return -1;
+  sqlite3_int64 available = p->read_ofst + p->read_len - iOfst;
+  int read_bytes = available < 0 ? 0 : (available < iAmt ? (int)available : iAmt);
+  memcpy(zBuf, &p->read_buf[iOfst - p->read_ofst], read_bytes);
+  return read_bytes;
 }
 
 // Read data from a file.
 static int denoRead(sqlite3_file *pFile, void *zBuf, int iAmt, sqlite_int64 iOfst) {
   DenoFile *p = (DenoFile*)pFile;
 
+  vfs_stats[VFS_STAT_READS] += 1;
+  vfs_stats[VFS_STAT_BYTES_READ] += iAmt;
+
   int read_bytes = 0;
+  int sequential = iOfst >= p->read_next && iOfst - p->read_next <= READ_AHEAD_GAP;
+  p->read_next = iOfst + iAmt;
 
-  if (iOfst <= JS_MAX_SAFE_INTEGER) {
-    // Read bytes from buffer
-    read_bytes = js_read(p->rid, (char*)zBuf, (double)iOfst, iAmt);
-    debug_printf("attempt to read from file (rid %i, amount %i, offset %lli, read %i)\n",
+  // Buffered writes need to reach the file before we read it back
+  if (write_file == p && iOfst < write_ofst + write_len && iOfst + iAmt > write_ofst) {
+    if (denoFlush() != SQLITE_OK)
+      return SQLITE_IOERR_READ;
+  }
+
+  if (iOfst > JS_MAX_SAFE_INTEGER) {
+    debug_printf("read offset %lli overflows JS_MAX_SAFE_INTEGER\n", iOfst);
+  } else if ((read_bytes = denoReadAhead(p, (char*)zBuf, iAmt, iOfst)) >= 0) {
+    debug_printf("read from read-ahead block (rid %i, amount %i, offset %lli, read %i)\n",
       p->rid, iAmt, iOfst, read_bytes);
   } else {
-    debug_printf("read offset %lli overflows JS_MAX_SAFE_INTEGER\n", iOfst);
+    // Sequential reads fetch a whole block at once
+    if (sequential && iAmt < READ_AHEAD_BYTES && !p->read_buf)
+      p->read_buf = sqlite3_malloc(READ_AHEAD_BYTES);
+    if (sequential && iAmt < READ_AHEAD_BYTES && p->read_buf) {
+      if (write_file == p && denoFlush() != SQLITE_OK)
+        return SQLITE_IOERR_READ;
+      p->read_ofst = iOfst;
+      JS_IO(p->read_len = js_read(p->rid, p->read_buf, (double)iOfst, READ_AHEAD_BYTES));
+      vfs_stats[VFS_STAT_JS_READS] += 1;
+      read_bytes = denoReadAhead(p, (char*)zBuf, iAmt, iOfst);
+      debug_printf("read ahead from file (rid %i, amount %i, offset %lli, read %i)\n",
+        p->rid, READ_AHEAD_BYTES, iOfst, p->read_len);
+    } else {
+      // Read bytes from buffer
+      JS_IO(read_bytes = js_read(p->rid, (char*)zBuf, (double)iOfst, iAmt));
+      vfs_stats[VFS_STAT_JS_READS] += 1;
+      debug_printf("attempt to read from file (rid %i, amount %i, offset %lli, read %i)\n",
+        p->rid, iAmt, iOfst, read_bytes);
+    }
   }
 
   // Zero memory if read was short
@@ -55,26 +177,66 @@ static int denoRead(sqlite3_file *pFile, void *zBuf, int iAmt, sqlite_int64 iOfs
 // Write data to a file.
 static int denoWrite(sqlite3_file *pFile, const void *zBuf, int iAmt, sqlite_int64 iOfst) {
   DenoFile *p = (DenoFile*)pFile;
+  vfs_stats[VFS_STAT_WRITES] += 1;
+  vfs_stats[VFS_STAT_BYTES_WRITTEN] += iAmt;
 
-  int write_bytes = 0;
-
-  if (iOfst <= JS_MAX_SAFE_INTEGER) {
-    // Write bytes to buffer
-    write_bytes = js_write(p->rid, (char*)zBuf, (double)iOfst, iAmt);
-    debug_printf("attempt to write to file (rid %i, amount %i, offset %lli, written %i)\n",
-      p->rid, iAmt, iOfst, write_bytes);
-  } else {
+  if (iOfst + iAmt > JS_MAX_SAFE_INTEGER) {
     debug_printf("write offset %lli overflows JS_MAX_SAFE_INTEGER\n", iOfst);
+    return SQLITE_IOERR_WRITE;
+  }
+
+  // Keep the read-ahead block and cached size up to date
+  if (p->read_len >= 0 && iOfst < p->read_ofst + READ_AHEAD_BYTES && iOfst + iAmt > p->read_ofst)
+    p->read_len = -1;
+  if (p->size >= 0 && iOfst + iAmt > p->size)
+    p->size = iOfst + iAmt;
+
+  if (write_file == p && iOfst >= write_ofst && iOfst <= write_ofst + write_len
+      && iOfst + iAmt <= write_ofst + WRITE_BEHIND_BYTES) {
+    // Merge with (or overwrite) buffered writes
+    memcpy(&write_buf[iOfst - write_ofst], zBuf, iAmt);
+    if (iOfst + iAmt > write_ofst + write_len)
+      write_len = (int)(iOfst + iAmt - write_ofst);
+    debug_printf("buffered write (rid %i, amount %i, offset %lli)\n", p->rid, iAmt, iOfst);
+    return SQLITE_OK;
   }
 
+  int status = denoFlush();
+  if (status != SQLITE_OK)
+    return status;
+
+  if (iAmt < WRITE_BEHIND_BYTES) {
+    memcpy(write_buf, zBuf, iAmt);
+    write_file = p;
+    write_ofst = iOfst;
+    write_len = iAmt;
+    debug_printf("buffered write (rid %i, amount %i, offset %lli)\n", p->rid, iAmt, iOfst);
+    return SQLITE_OK;
+  }
+
+  // Write bytes to buffer
+  int write_bytes;
+  JS_IO(write_bytes = js_write(p->rid, (char*)zBuf, (double)iOfst, iAmt));
+  vfs_stats[VFS_STAT_JS_WRITES] += 1;
+  debug_printf("attempt to write to file (rid %i, amount %i, offset %lli, written %i)\n",
+    p->rid, iAmt, iOfst, write_bytes);
   return write_bytes == iAmt ? SQLITE_OK : SQLITE_IOERR_WRITE;
 }
 
 // Truncate file.
 static int denoTruncate(sqlite3_file *pFile, sqlite_int64 size) {
   DenoFile *p = (DenoFile*)pFile;
+  if (write_file == p && denoFlush() != SQLITE_OK)
+    return SQLITE_IOERR_TRUNCATE;
+
+  // Keep the file a multiple of the chunk size
+  if (p->chunk_size > 0)
+    size = ((size + p->chunk_size - 1) / p->chunk_size) * p->chunk_size;
+
   if (size <= JS_MAX_SAFE_INTEGER) {
-    js_truncate(p->rid, (double)size);
+    JS_IO(js_truncate(p->rid, (double)size));
+    p->read_len = -1;
+    p->size = size;
     debug_printf("truncating file (rid %i, size: %lli)\n", p->rid, size);
     return SQLITE_OK;
   } else {
@@ -88,7 +250,10 @@ static int denoTruncate(sqlite3_file *pFile, sqlite_int64 size) {
 // TODO(dyedgreen): Investigate if there is a better way
 static int denoSync(sqlite3_file *pFile, int flags) {
   DenoFile *p = (DenoFile*)pFile;
-  js_sync(p->rid);
+  vfs_stats[VFS_STAT_SYNCS] += 1;
+  if (write_file == p && denoFlush() != SQLITE_OK)
+    return SQLITE_IOERR_FSYNC;
+  JS_IO(js_sync(p->rid));
   debug_printf("syncing file (rid %i)\n", p->rid);
   return SQLITE_OK;
 }
@@ -96,43 +261,75 @@ static int denoSync(sqlite3_file *pFile, int flags) {
 // Write the size of the file in bytes to *pSize.
 static int denoFileSize(sqlite3_file *pFile, sqlite_int64 *pSize) {
   DenoFile *p = (DenoFile*)pFile;
-  *pSize = (sqlite_int64)js_size(p->rid);
-  debug_printf("read file size: %lli (rid %i)\n", *pSize, p->rid);
+  if (p->size < 0) {
+    JS_IO(p->size = (sqlite_int64)js_size(p->rid));
+    // Account for writes which are still buffered
+    if (write_file == p && write_ofst + write_len > p->size)
+      p->size = write_ofst + write_len;
+    debug_printf("read file size: %lli (rid %i)\n", p->size, p->rid);
+  }
+  *pSize = p->size;
   return SQLITE_OK;
 }
 
 // File locking
 static int denoLock(sqlite3_file *pFile, int eLock) {
   DenoFile *p = (DenoFile*)pFile;
+  if (p->shm_locked) {
+    // Already exclusive, see `denoShmMap`. The level is still tracked,
+    // so `denoShmUnmap` knows which lock to keep.
+    p->lock = eLock;
+    return SQLITE_OK;
+  }
   switch (eLock) {
     case SQLITE_LOCK_NONE:
       // no op
       break;
     case SQLITE_LOCK_SHARED:
-    case SQLITE_LOCK_RESERVED: // one WASM process <-> one open database
-      js_lock(p->rid, 0);
+      if (p->lock == SQLITE_LOCK_NONE) {
+        JS_IO(js_lock(p->rid, 0));
+        // Others might have changed the file since we last held a lock
+        denoInvalidate(p);
+      }
       break;
+    // File locks can't express RESERVED, and `denoCheckReservedLock`
+    // can't see it. So writers lock exclusively from the start of the
+    // write transaction, otherwise a reader (e.g. a second connection
+    // to the same file) could mistake the journal for a hot journal.
+    case SQLITE_LOCK_RESERVED:
     case SQLITE_LOCK_PENDING:
     case SQLITE_LOCK_EXCLUSIVE:
-      js_lock(p->rid, 1);
+      if (p->lock < SQLITE_LOCK_RESERVED)
+        JS_IO(js_lock(p->rid, 1));
       break;
   }
+  p->lock = eLock;
   return SQLITE_OK;
 }
 
 static int denoUnlock(sqlite3_file *pFile, int eLock) {
     DenoFile *p = (DenoFile*)pFile;
+  // Others must see our writes once we release the lock
+  if (denoFlush() != SQLITE_OK)
+    return SQLITE_IOERR_UNLOCK;
+  if (p->shm_locked) {
+    p->lock = eLock; // released in `denoShmUnmap`
+    return SQLITE_OK;
+  }
   switch (eLock) {
     case SQLITE_LOCK_NONE:
-      // no op
+      // Ends every transaction, including read-only ones. Holding on to
+      // a shared lock would block other connections from writing.
+      if (p->lock >= SQLITE_LOCK_SHARED)
+        JS_IO(js_unlock(p->rid));
       break;
     case SQLITE_LOCK_SHARED:
-    case SQLITE_LOCK_RESERVED:
-    case SQLITE_LOCK_PENDING:
-    case SQLITE_LOCK_EXCLUSIVE:
-      js_unlock(p->rid);
+      // Ends a write transaction, but SQLite keeps reading
+      if (p->lock > SQLITE_LOCK_SHARED)
+        JS_IO(js_lock(p->rid, 0));
       break;
   }
+  p->lock = eLock;
   return SQLITE_OK;
 }
 
@@ -141,17 +338,114 @@ static int denoCheckReservedLock(sqlite3_file *pFile, int *pResOut) {
   return SQLITE_OK;
 }
 
-// No xFileControl() verbs are implemented by this VFS.
+// Implements SQLITE_FCNTL_CHUNK_SIZE and SQLITE_FCNTL_SIZE_HINT,
+// which let SQLite grow files in large steps.
 static int denoFileControl(sqlite3_file *pFile, int op, void *pArg) {
+  DenoFile *p = (DenoFile*)pFile;
+  switch (op) {
+    case SQLITE_FCNTL_CHUNK_SIZE:
+      p->chunk_size = *(int*)pArg;
+      debug_printf("set chunk size %i (rid %i)\n", p->chunk_size, p->rid);
+      return SQLITE_OK;
+    case SQLITE_FCNTL_SIZE_HINT: {
+      if (p->chunk_size > 0) {
+        sqlite3_int64 hint = *(sqlite3_int64*)pArg;
+        sqlite3_int64 size;
+        denoFileSize(pFile, &size);
+        if (hint > size)
+          return denoTruncate(pFile, hint);
+      }
+      return SQLITE_OK;
+    }
+  }
   return SQLITE_NOTFOUND;
 }
 
-// TODO(dyedgreen): Should we try to get these?
 static int denoSectorSize(sqlite3_file *pFile) {
-  return 0;
+  return SECTOR_SIZE;
 }
+
+// Like the default unix VFS we assume that writing part of
+// a sector does not damage the remaining bytes on power loss.
 static int denoDeviceCharacteristics(sqlite3_file *pFile) {
-  return 0;
+  return SQLITE_IOCAP_POWERSAFE_OVERWRITE;
+}
+
+// WAL-index support. We can not memory map files, so the WAL-index
+// lives in the heap memory of this instance instead of a shared file.
+// This is only safe if no other connection uses the database, thus
+// the database file is locked exclusively for as long as the WAL-index
+// is mapped (this corresponds to `PRAGMA locking_mode=EXCLUSIVE`).
+static int denoShmMap(
+  sqlite3_file *pFile,            /* Database file */
+  int iRegion,                    /* Region to map */
+  int szRegion,                   /* Size of each region */
+  int bExtend,                    /* Allocate region if it does not exist */
+  void volatile **pp              /* Pointer to region */
+) {
+  DenoFile *p = (DenoFile*)pFile;
+  if (!p->shm_locked) {
+    JS_IO(js_lock(p->rid, 1));
+    p->shm_locked = 1;
+    debug_printf("locked file for WAL-index (rid %i)\n", p->rid);
+  }
+
+  if (iRegion >= p->shm_count) {
+    if (!bExtend) {
+      *pp = NULL;
+      return SQLITE_OK;
+    }
+    void** regions = sqlite3_realloc(p->shm_regions, (iRegion + 1) * sizeof(void*));
+    if (!regions)
+      return SQLITE_IOERR_NOMEM;
+    p->shm_regions = regions;
+    while (p->shm_count <= iRegion) {
+      void* region = sqlite3_malloc(szRegion);
+      if (!region)
+        return SQLITE_IOERR_NOMEM;
+      memset(region, 0, szRegion);
+      p->shm_regions[p->shm_count++] = region;
+    }
+    debug_printf("grew WAL-index to %i regions (rid %i)\n", p->shm_count, p->rid);
+  }
+
+  *pp = p->shm_regions[iRegion];
+  return SQLITE_OK;
+}
+
+// There is only one connection using the WAL-index,
+// so all locks are granted.
+static int denoShmLock(sqlite3_file *pFile, int offset, int n, int flags) {
+  // Transactions end by releasing their locks, see `denoUnlock`
+  if ((flags & SQLITE_SHM_UNLOCK) && denoFlush() != SQLITE_OK)
+    return SQLITE_IOERR_SHMLOCK;
+  return SQLITE_OK;
+}
+
+// We run single-threaded, so there is nothing to do.
+static void denoShmBarrier(sqlite3_file *pFile) {
+  return;
+}
+
+// Free the WAL-index, and release the lock on the database file
+// down to the level SQLite still holds (e.g. when switching from
+// WAL mode to a rollback journal in the middle of a transaction).
+static int denoShmUnmap(sqlite3_file *pFile, int deleteFlag) {
+  DenoFile *p = (DenoFile*)pFile;
+  for (int i = 0; i < p->shm_count; i ++)
+    sqlite3_free(p->shm_regions[i]);
+  sqlite3_free(p->shm_regions);
+  p->shm_regions = NULL;
+  p->shm_count = 0;
+  if (p->shm_locked) {
+    if (p->lock == SQLITE_LOCK_NONE)
+      JS_IO(js_unlock(p->rid));
+    else if (p->lock == SQLITE_LOCK_SHARED)
+      JS_IO(js_lock(p->rid, 0));
+    p->shm_locked = 0;
+    debug_printf("released WAL-index (rid %i, lock %i)\n", p->rid, p->lock);
+  }
+  return SQLITE_OK;
 }
 
 // Open a file handle.
@@ -163,7 +457,7 @@ static int denoOpen(
   int *pOutFlags                  /* Output SQLITE_OPEN_XXX flags (or NULL) */
 ) {
   static const sqlite3_io_methods denoio = {
-    1,                            /* iVersion */
+    2,                            /* iVersion */
     denoClose,                    /* xClose */
     denoRead,                     /* xRead */
     denoWrite,                    /* xWrite */
@@ -175,17 +469,30 @@ static int denoOpen(
     denoCheckReservedLock,        /* xCheckReservedLock */
     denoFileControl,              /* xFileControl */
     denoSectorSize,               /* xSectorSize */
-    denoDeviceCharacteristics     /* xDeviceCharacteristics */
+    denoDeviceCharacteristics,    /* xDeviceCharacteristics */
+    denoShmMap,                   /* xShmMap */
+    denoShmLock,                  /* xShmLock */
+    denoShmBarrier,               /* xShmBarrier */
+    denoShmUnmap                  /* xShmUnmap */
   };
 
   DenoFile *p = (DenoFile*)pFile;
   p->base.pMethods = &denoio;
+  p->lock = SQLITE_LOCK_NONE;
+  p->size = -1;
+  p->chunk_size = 0;
+  p->read_buf = NULL;
+  p->read_len = -1;
+  p->read_next = -1;
+  p->shm_count = 0;
+  p->shm_regions = NULL;
+  p->shm_locked = 0;
 
   // TODO(dyedgreen): The current approach is to raise
   // the permission error on the vfs.js side of things,
   // should the error be propagates through the wrapper
   // and be raised on the wrapper side of things?
-  p->rid = js_open(zName, zName ? 0 : 1, flags);
+  JS_IO(p->rid = js_open(zName, zName ? 0 : 1, flags));
 
   if (pOutFlags) {
     *pOutFlags = flags;
@@ -198,7 +505,11 @@ static int denoOpen(
 
 // Delete the file at the path.
 static int denoDelete(sqlite3_vfs *pVfs, const char *zPath, int dirSync) {
-  js_delete(zPath);
+  // Deleting a journal commits a transaction, so all
+  // writes before it must reach their files first
+  if (denoFlush() != SQLITE_OK)
+    return SQLITE_IOERR_DELETE;
+  JS_IO(js_delete(zPath));
   return SQLITE_OK;
 }
 
@@ -206,10 +517,10 @@ static int denoDelete(sqlite3_vfs *pVfs, const char *zPath, int dirSync) {
 static int denoAccess(sqlite3_vfs *pVfs, const char *zPath, int flags, int *pResOut) {
   switch (flags) {
     case SQLITE_ACCESS_EXISTS:
-      *pResOut = js_exists(zPath);
+      JS_IO(*pResOut = js_exists(zPath));
       break;
     default:
-      *pResOut = js_access(zPath);
+      JS_IO(*pResOut = js_access(zPath));
       break;
   }
   debug_printf("determining file access (path %s, access %i)\n", zPath, *pResOut);
@@ -0,0 +1,26 @@
+#ifndef VFS_H
+#define VFS_H
+
+// I/O statistics gathered by the VFS for all files
+// opened by this instance. Counts are stored as doubles,
+// so they can be passed to JS without overflowing.
+
+#define VFS_STAT_READS         0 // calls to xRead
+#define VFS_STAT_WRITES        1 // calls to xWrite
+#define VFS_STAT_SYNCS         2 // calls to xSync
+#define VFS_STAT_BYTES_READ    3 // bytes requested by xRead
+#define VFS_STAT_BYTES_WRITTEN 4 // bytes passed to xWrite
+#define VFS_STAT_JS_CALLS      5 // calls to any js_* file function
+#define VFS_STAT_JS_READS      6 // calls to js_read
+#define VFS_STAT_JS_WRITES     7 // calls to js_write
+#define VFS_STAT_JS_TIME       8 // time spent in js_* file functions (ms),
+                                 // only measured if vfs_timing is set
+#define VFS_STAT_COUNT         9
+
+extern double vfs_stats[VFS_STAT_COUNT];
+
+// Timing a file function takes two extra calls into JS,
+// so it is off by default.
+extern int vfs_timing;
+
+#endif // VFS_H
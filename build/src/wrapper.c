@@ -1,16 +1,56 @@
 #include <stdlib.h>
+#include <string.h>
 #include <sqlite3.h>
 #include <pcg.h>
 #include "imports.h"
+#include "vfs.h"
 #include "debug.h"
 
 #define EXPORT(name) __attribute__((used)) __attribute__((export_name (#name))) name
 #define ERROR_VAL -1
 
 #define BIG_INT_TYPE 6
+
+// Kinds of calls made by `js_call_user_func`
+#define CALL_SCALAR 0
+#define CALL_STEP 1
+#define CALL_FINAL 2
+#define CALL_VALUE 3
+#define CALL_INVERSE 4
 #define JS_MAX_SAFE_INTEGER 9007199254740991
 #define JS_MIN_SAFE_INTEGER (-JS_MAX_SAFE_INTEGER)
 
+// Rows packed by `step_rows` are written into an arena which
+// is re-used between calls. A batch is cut short once it grows
+// beyond ROW_BATCH_BYTES, and arenas which grew past
+// ARENA_RETAIN_BYTES (e.g. for a huge blob) are released before
+// the next batch.
+#define ARENA_MIN_BYTES 4096
+#define ARENA_RETAIN_BYTES (1 << 20)
+#define ROW_BATCH_BYTES (1 << 18)
+#define ROW_HEADER_BYTES 12
+
+// UTF-16 length reported for text which is not valid UTF-8
+#define UTF16_INVALID 0xFFFFFFFF
+
+// Incremental blob I/O moves data through a fixed staging
+// buffer of this size
+#define BLOB_BUFFER_BYTES 65536
+
+// Number of values returned by `db_stats` and `stmt_stats`
+#define MEMORY_STATS 4
+#define DB_STATUS_STATS 11
+#define DB_STATS_COUNT (VFS_STAT_COUNT + 2 * (MEMORY_STATS + DB_STATUS_STATS))
+#define STMT_STATS_COUNT 7
+
+// Growable byte buffer backed by sqlite3_malloc.
+typedef struct Arena Arena;
+struct Arena {
+  unsigned char* data;
+  sqlite3_int64 size;
+  sqlite3_int64 capacity;
+};
+
 // Status returned by last instruction
 int last_status = SQLITE_OK;
 
@@ -24,8 +64,109 @@ sqlite3* database = NULL;
 // Current context for user defined SQL function
 sqlite3_context* current_ctx = NULL;
 
-// Current arguments for user defined SQL function
-sqlite3_value** current_argv = NULL;
+// Aggregate states are identified by an id stored in the
+// aggregate context, which is passed to JS. Id 0 is used
+// if no state exists.
+int last_aggregate_id = 0;
+
+// Arenas holding the most recent batch of rows
+// packed by `step_rows`
+Arena row_arena = { NULL, 0, 0 };
+Arena text_arena = { NULL, 0, 0 };
+
+// Arenas holding the arguments of the most recent
+// call to a user defined SQL function
+Arena arg_arena = { NULL, 0, 0 };
+Arena arg_text_arena = { NULL, 0, 0 };
+
+// Staging buffer for `blob_read` and `blob_write`
+unsigned char blob_buffer_data[BLOB_BUFFER_BYTES];
+
+// Buffers for the values returned by `db_stats`
+// and `stmt_stats`
+double db_stats_buf[DB_STATS_COUNT];
+double stmt_stats_buf[STMT_STATS_COUNT];
+
+// Make sure the arena can hold `bytes` more bytes. Returns
+// 0 if the memory could not be allocated.
+static int arena_reserve(Arena* arena, sqlite3_int64 bytes) {
+  if (arena->size + bytes <= arena->capacity)
+    return 1;
+  sqlite3_int64 capacity = arena->capacity ? arena->capacity : ARENA_MIN_BYTES;
+  while (capacity < arena->size + bytes) capacity *= 2;
+  unsigned char* data = sqlite3_realloc64(arena->data, (sqlite3_uint64)capacity);
+  if (!data) {
+    debug_printf("failed to grow arena to %lli bytes\n", capacity);
+    return 0;
+  }
+  arena->data = data;
+  arena->capacity = capacity;
+  return 1;
+}
+
+// Append bytes to the arena. Space must have been
+// reserved before.
+static void arena_put(Arena* arena, const void* bytes, sqlite3_int64 size) {
+  if (size > 0)
+    memcpy(&arena->data[arena->size], bytes, (size_t)size);
+  arena->size += size;
+}
+
+// Empty the arena, releasing its memory if it grew
+// too large to keep around.
+static void arena_clear(Arena* arena) {
+  if (arena->capacity > ARENA_RETAIN_BYTES) {
+    sqlite3_free(arena->data);
+    arena->data = NULL;
+    arena->capacity = 0;
+  }
+  arena->size = 0;
+}
+
+// Number of UTF-16 code units needed to represent the
+// given UTF-8 text. This allows JS to split a batch of
+// strings decoded in one go. Returns UTF16_INVALID if the
+// text is not valid UTF-8, since the decoder replaces bad
+// bytes in ways the count can not follow.
+static uint32_t utf16_len(const unsigned char* text, int bytes) {
+  uint32_t len = 0;
+  int i = 0;
+  while (i < bytes) {
+    unsigned char c = text[i];
+    if (c < 0x80) {
+      len ++;
+      i ++;
+      continue;
+    }
+    // Length of the sequence and the allowed range of its second
+    // byte, which excludes overlong forms, surrogates, and values
+    // above U+10FFFF
+    int seq;
+    unsigned char low = 0x80, high = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF) {
+      seq = 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+      seq = 3;
+      if (c == 0xE0) low = 0xA0;
+      if (c == 0xED) high = 0x9F;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+      seq = 4;
+      if (c == 0xF0) low = 0x90;
+      if (c == 0xF4) high = 0x8F;
+    } else {
+      return UTF16_INVALID;
+    }
+    if (i + seq > bytes || text[i + 1] < low || text[i + 1] > high)
+      return UTF16_INVALID;
+    for (int j = 2; j < seq; j ++) {
+      if ((text[i + j] & 0xC0) != 0x80)
+        return UTF16_INVALID;
+    }
+    len += seq == 4 ? 2 : 1; // surrogate pair
+    i += seq;
+  }
+  return len;
+}
 
 
 // Return length of string pointed to by str.
@@ -187,10 +328,10 @@ int EXPORT(bind_text) (sqlite3_stmt* stmt, int idx, const char* value) {
 }
 
 int EXPORT(bind_blob) (sqlite3_stmt* stmt, int idx, void* value, int size) {
-  // SQLite retrains the pointer until we execute the statement, but any pointers
-  // passed in from JS are freed when the function returns. Thus we need to mark
-  // is as transient.
-  last_status = sqlite3_bind_blob(stmt, idx, value, size, SQLITE_TRANSIENT);
+  // The value must be allocated with `sqlite_malloc`, and is owned by SQLite
+  // from here on. This avoids copying the blob a second time, which matters
+  // for large values. SQLite frees the value even if binding fails.
+  last_status = sqlite3_bind_blob(stmt, idx, value, size, sqlite3_free);
   debug_printf("binding blob '%s' (status %i)\n", value, last_status);
   return last_status;
 }
@@ -211,6 +352,90 @@ int EXPORT(bind_null) (sqlite3_stmt* stmt, int idx) {
   return last_status;
 }
 
+// Bind every parameter set in `batch` and execute the statement
+// once for each of them, discarding any result rows. Returns the
+// number of rows executed successfully; if this is less than
+// `rows`, the status of the failed row is available from
+// `get_status`.
+//
+// Each parameter set starts with a uint32 parameter count, followed
+// by one cell per parameter using the same format as `step_rows`,
+// except that text values are stored inline like blobs. Bindings
+// are cleared before each set, so parameters it leaves out are
+// NULL (as with `bind_*`, after `clear_bindings`). Text and blobs
+// are bound without copying, so all bindings are also cleared
+// before returning.
+int EXPORT(execute_batch) (sqlite3_stmt* stmt, const void* batch, int rows) {
+  const unsigned char* cursor = (const unsigned char*)batch;
+  last_status = SQLITE_DONE;
+
+  int row;
+  for (row = 0; row < rows; row ++) {
+    uint32_t params;
+    memcpy(&params, cursor, 4);
+    cursor += 4;
+
+    sqlite3_clear_bindings(stmt);
+    for (int idx = 1; idx <= (int)params; idx ++) {
+      unsigned char tag = *cursor;
+      cursor += 1;
+      switch (tag) {
+        case SQLITE_INTEGER: {
+          double num_val;
+          memcpy(&num_val, cursor, 8);
+          cursor += 8;
+          last_status = sqlite3_bind_int64(stmt, idx, (sqlite3_int64)num_val);
+          break;
+        }
+        case SQLITE_FLOAT: {
+          double num_val;
+          memcpy(&num_val, cursor, 8);
+          cursor += 8;
+          last_status = sqlite3_bind_double(stmt, idx, num_val);
+          break;
+        }
+        case BIG_INT_TYPE: {
+          sqlite3_int64 int_val;
+          memcpy(&int_val, cursor, 8);
+          cursor += 8;
+          last_status = sqlite3_bind_int64(stmt, idx, int_val);
+          break;
+        }
+        case SQLITE_TEXT:
+        case SQLITE_BLOB: {
+          uint32_t len;
+          memcpy(&len, cursor, 4);
+          cursor += 4;
+          // The batch outlives the bindings, see above
+          if (tag == SQLITE_TEXT)
+            last_status = sqlite3_bind_text(stmt, idx, (const char*)cursor, (int)len, SQLITE_STATIC);
+          else
+            last_status = sqlite3_bind_blob(stmt, idx, cursor, (int)len, SQLITE_STATIC);
+          cursor += len;
+          break;
+        }
+        default:
+          last_status = sqlite3_bind_null(stmt, idx);
+          break;
+      }
+      if (last_status != SQLITE_OK)
+        goto done;
+    }
+
+    do {
+      last_status = sqlite3_step(stmt);
+    } while (last_status == SQLITE_ROW);
+    if (last_status != SQLITE_DONE)
+      goto done;
+    sqlite3_reset(stmt);
+  }
+
+done:
+  sqlite3_clear_bindings(stmt);
+  debug_printf("executed batch of %i rows (status %i)\n", row, last_status);
+  return row;
+}
+
 // Determine parameter index for named parameters.
 int EXPORT(bind_parameter_index) (sqlite3_stmt* stmt, const char* name) {
   int index = sqlite3_bind_parameter_index(stmt, name);
@@ -292,76 +517,286 @@ int EXPORT(column_bytes) (sqlite3_stmt* stmt, int col) {
   return sqlite3_column_bytes(stmt, col);
 }
 
-// Custom function implementation.
-void func_impl(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
-  current_ctx = ctx;
-  current_argv = argv;
+// Append a value to the given arenas, see `step_rows` for the
+// format. Returns 0 if out of memory.
+static int pack_value(Arena* cells, Arena* text, sqlite3_value* value) {
+  // Largest fixed size cell is tag + two 32 bit lengths
+  if (!arena_reserve(cells, 9))
+    return 0;
+  unsigned char tag = (unsigned char)sqlite3_value_type(value);
+  switch (tag) {
+    case SQLITE_INTEGER: {
+      sqlite3_int64 int_val = sqlite3_value_int64(value);
+      if (int_val > JS_MAX_SAFE_INTEGER || int_val < JS_MIN_SAFE_INTEGER) {
+        tag = BIG_INT_TYPE;
+        arena_put(cells, &tag, 1);
+        arena_put(cells, &int_val, 8);
+      } else {
+        double num_val = (double)int_val;
+        arena_put(cells, &tag, 1);
+        arena_put(cells, &num_val, 8);
+      }
+      break;
+    }
+    case SQLITE_FLOAT: {
+      double num_val = sqlite3_value_double(value);
+      arena_put(cells, &tag, 1);
+      arena_put(cells, &num_val, 8);
+      break;
+    }
+    case SQLITE_TEXT: {
+      const unsigned char* text_val = sqlite3_value_text(value);
+      int bytes = text_val ? sqlite3_value_bytes(value) : 0;
+      uint32_t len = (uint32_t)bytes;
+      uint32_t units = utf16_len(text_val, bytes);
+      if (!arena_reserve(text, bytes))
+        return 0;
+      // Sum the units per value in the header; checking the text of
+      // the whole batch would miss invalid values which happen to
+      // form a valid sequence once joined.
+      uint32_t total_units;
+      memcpy(&total_units, &cells->data[8], 4);
+      if (units == UTF16_INVALID || total_units == UTF16_INVALID)
+        total_units = UTF16_INVALID;
+      else
+        total_units += units;
+      memcpy(&cells->data[8], &total_units, 4);
+      arena_put(cells, &tag, 1);
+      arena_put(cells, &len, 4);
+      arena_put(cells, &units, 4);
+      arena_put(text, text_val, bytes);
+      break;
+    }
+    case SQLITE_BLOB: {
+      const void* blob = sqlite3_value_blob(value);
+      if (!blob) {
+        // Zero pointer results in null
+        tag = SQLITE_NULL;
+        arena_put(cells, &tag, 1);
+        break;
+      }
+      int bytes = sqlite3_value_bytes(value);
+      uint32_t len = (uint32_t)bytes;
+      if (!arena_reserve(cells, 5 + (sqlite3_int64)bytes))
+        return 0;
+      arena_put(cells, &tag, 1);
+      arena_put(cells, &len, 4);
+      arena_put(cells, blob, bytes);
+      break;
+    }
+    default:
+      tag = SQLITE_NULL;
+      arena_put(cells, &tag, 1);
+      break;
+  }
+  return 1;
+}
 
-  int func = (int)sqlite3_user_data(ctx);
-  js_call_user_func(func, argc);
+// Reset the arenas to hold a new batch of values.
+// Returns 0 if out of memory.
+static int pack_start(Arena* cells, Arena* text) {
+  arena_clear(cells);
+  arena_clear(text);
+  if (!arena_reserve(cells, ROW_HEADER_BYTES))
+    return 0;
+  // `pack_value` sums the UTF-16 length in the header
+  memset(cells->data, 0, ROW_HEADER_BYTES);
+  cells->size = ROW_HEADER_BYTES;
+  return 1;
+}
+
+// Write the header and move the text data behind the
+// cells. Returns 0 if out of memory.
+static int pack_finish(Arena* cells, Arena* text) {
+  uint32_t header[2] = {
+    (uint32_t)(cells->size - ROW_HEADER_BYTES),
+    (uint32_t)text->size,
+  };
+  if (!arena_reserve(cells, text->size))
+    return 0;
+  memcpy(cells->data, header, sizeof(header));
+  arena_put(cells, text->data, text->size);
+  return 1;
+}
+
+// Step the statement up to `max_rows` times and pack every
+// returned row into a single buffer, which can be obtained
+// from `row_buffer`. Returns the number of rows packed; the
+// status of the last step is available from `get_status` and
+// is SQLITE_ROW if there may be more rows.
+//
+// The buffer starts with a header of three uint32 values: the
+// number of bytes of cell data, the number of bytes of text
+// data, and the number of UTF-16 code units in the text data
+// (UTF16_INVALID if any text is not valid UTF-8).
+// Then follow the cells, row by row, each starting with a one
+// byte type tag:
+// - SQLITE_INTEGER, SQLITE_FLOAT: double value
+// - BIG_INT_TYPE: int64 value
+// - SQLITE_TEXT: uint32 byte length, uint32 UTF-16 length
+// - SQLITE_BLOB: uint32 byte length, followed by the bytes
+// - SQLITE_NULL: no payload
+// Finally the bytes of all text values are stored back to back,
+// so they can be decoded at once. All values are little endian.
+int EXPORT(step_rows) (sqlite3_stmt* stmt, int max_rows) {
+  if (!pack_start(&row_arena, &text_arena)) {
+    last_status = SQLITE_NOMEM;
+    return 0;
+  }
 
-  current_ctx = NULL;
-  current_argv = NULL;
-}
+  int columns = sqlite3_column_count(stmt);
+  int rows = 0;
+  while (rows < max_rows && row_arena.size + text_arena.size < ROW_BATCH_BYTES) {
+    last_status = sqlite3_step(stmt);
+    if (last_status != SQLITE_ROW)
+      break;
+    int packed = 1;
+    for (int col = 0; col < columns && packed; col ++)
+      packed = pack_value(&row_arena, &text_arena, sqlite3_column_value(stmt, col));
+    if (!packed) {
+      last_status = SQLITE_NOMEM;
+      break;
+    }
+    rows ++;
+  }
 
-// Create a custom function that calls a JS defined function implementation.
-// The way we perform this call works as follows:
-// - func impl is passed an index into an array of functions we keep on the JS side
-// - before calling the JS function, we store the context and argument array into two globals
-// - then the JS function has access to these via the `argument_*` and `result_*` functions
-//   below
-// - finally we clean up the globals after the function returns
-int EXPORT(create_function) (const char* funcname, int argc, int flags, int func) {
-  flags = SQLITE_UTF8 | flags;
-  last_status = sqlite3_create_function(database, funcname, argc, flags, (void *)func, &func_impl, NULL, NULL);
-  debug_printf("creating function: %s (argc %i, func %i, status %i)\n", funcname, argc, func, last_status);
-  return last_status;
+  if (!pack_finish(&row_arena, &text_arena)) {
+    last_status = SQLITE_NOMEM;
+    return 0;
+  }
+
+  debug_printf("stepped %i rows into %lli bytes (status %i)\n", rows, row_arena.size, last_status);
+  return rows;
 }
 
-// Delete a custom function.
-int EXPORT(delete_function) (const char* funcname) {
-  last_status = sqlite3_create_function(database, funcname, 0, 0, NULL, NULL, NULL, NULL);
-  debug_printf("deleting function: %s (status %i)\n", funcname, last_status);
-  return last_status;
+// Buffer holding the rows packed by the most
+// recent call to `step_rows`.
+void* EXPORT(row_buffer) () {
+  return (void*)row_arena.data;
 }
 
-// Determine type of argument. Returns SQLITE column types.
-// Calling this outside of of a call to`js_call_user_func`
-// is undefined.
-int EXPORT(argument_type) (int arg) {
-  int type = sqlite3_value_type(current_argv[arg]);
-  if (type == SQLITE_INTEGER) {
-    // handle integers that exceed JS_MAX_SAFE_INTEGER
-    sqlite3_int64 col_val = sqlite3_value_int64(current_argv[arg]);
-    if (col_val > JS_MAX_SAFE_INTEGER || col_val < JS_MIN_SAFE_INTEGER) {
-      debug_printf("detected big integer: %lld\n", col_val);
-      return BIG_INT_TYPE;
+// Call the JS implementation of a user defined function. The
+// arguments are packed into a buffer using the same format as
+// `step_rows` (with a single row), so JS can read all of them
+// at once. While the JS function runs, its context is stored
+// in `current_ctx`, where the `result_*` functions below can
+// access it.
+static void call_user_func(sqlite3_context* ctx, int call, int state, int argc, sqlite3_value** argv) {
+  if (!pack_start(&arg_arena, &arg_text_arena)) {
+    sqlite3_result_error_nomem(ctx);
+    return;
+  }
+  for (int arg = 0; arg < argc; arg ++) {
+    if (!pack_value(&arg_arena, &arg_text_arena, argv[arg])) {
+      sqlite3_result_error_nomem(ctx);
+      return;
     }
   }
-  return type;
+  if (!pack_finish(&arg_arena, &arg_text_arena)) {
+    sqlite3_result_error_nomem(ctx);
+    return;
+  }
+
+  // User defined functions may run queries which call
+  // other user defined functions. Those queries pack their
+  // rows into fresh arenas, so the rows an outer `step_rows`
+  // has packed so far are kept.
+  sqlite3_context* outer_ctx = current_ctx;
+  Arena outer_rows = row_arena;
+  Arena outer_text = text_arena;
+  current_ctx = ctx;
+  row_arena = (Arena){ NULL, 0, 0 };
+  text_arena = (Arena){ NULL, 0, 0 };
+  int func = (int)sqlite3_user_data(ctx);
+  js_call_user_func(func, call, state, argc, arg_arena.data);
+  sqlite3_free(row_arena.data);
+  sqlite3_free(text_arena.data);
+  row_arena = outer_rows;
+  text_arena = outer_text;
+  current_ctx = outer_ctx;
+}
+
+// Id of the state of the aggregate function call. If `create`
+// is not set, this returns 0 if the aggregate has no state yet,
+// and -1 if a state could not be allocated.
+static int aggregate_state(sqlite3_context* ctx, int create) {
+  int* state = sqlite3_aggregate_context(ctx, create ? sizeof(int) : 0);
+  if (!state)
+    return create ? -1 : 0;
+  if (*state == 0) {
+    last_aggregate_id = last_aggregate_id < INT32_MAX ? last_aggregate_id + 1 : 1;
+    *state = last_aggregate_id;
+  }
+  return *state;
 }
 
-// Wrap function argument readers. Calling these outside of
-// a call to `js_call_user_func` is undefined.
+// Custom function implementation.
+void func_impl(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+  call_user_func(ctx, CALL_SCALAR, 0, argc, argv);
+}
 
-double EXPORT(argument_int) (int arg) {
-  return (double)sqlite3_value_int64(current_argv[arg]);
+// Custom aggregate and window function implementations.
+void step_impl(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+  int state = aggregate_state(ctx, 1);
+  if (state < 0)
+    sqlite3_result_error_nomem(ctx);
+  else
+    call_user_func(ctx, CALL_STEP, state, argc, argv);
 }
 
-double EXPORT(argument_double) (int arg) {
-  return sqlite3_value_double(current_argv[arg]);
+void final_impl(sqlite3_context* ctx) {
+  call_user_func(ctx, CALL_FINAL, aggregate_state(ctx, 0), 0, NULL);
 }
 
-const char* EXPORT(argument_text) (int arg) {
-  return (const char*)sqlite3_value_text(current_argv[arg]);
+void value_impl(sqlite3_context* ctx) {
+  call_user_func(ctx, CALL_VALUE, aggregate_state(ctx, 0), 0, NULL);
 }
 
-const void* EXPORT(argument_blob) (int arg) {
-  return sqlite3_value_blob(current_argv[arg]);
+void inverse_impl(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+  call_user_func(ctx, CALL_INVERSE, aggregate_state(ctx, 0), argc, argv);
 }
 
-int EXPORT(argument_bytes) (int arg) {
-  return sqlite3_value_bytes(current_argv[arg]);
+// Create a custom function that calls a JS defined function implementation.
+// The way we perform this call works as follows:
+// - func impl is passed an index into an array of functions we keep on the JS side
+// - the arguments are packed into a buffer, which is passed to `js_call_user_func`
+//   together with the function index
+// - the JS function reports its result using the `result_*` functions below
+int EXPORT(create_function) (const char* funcname, int argc, int flags, int func) {
+  flags = SQLITE_UTF8 | flags;
+  last_status = sqlite3_create_function(database, funcname, argc, flags, (void *)func, &func_impl, NULL, NULL);
+  debug_printf("creating function: %s (argc %i, func %i, status %i)\n", funcname, argc, func, last_status);
+  return last_status;
+}
+
+// Create a custom aggregate function, which works the same way as
+// `create_function`. Every step, inverse, value, and final call is
+// passed to the same JS function, together with the kind of call and
+// the id of the aggregate state. If `window` is set, the function can
+// also be used as a window function.
+int EXPORT(create_aggregate) (const char* funcname, int argc, int flags, int func, int window) {
+  flags = SQLITE_UTF8 | flags;
+  last_status = sqlite3_create_window_function(
+    database,
+    funcname,
+    argc,
+    flags,
+    (void *)func,
+    &step_impl,
+    &final_impl,
+    window ? &value_impl : NULL,
+    window ? &inverse_impl : NULL,
+    NULL
+  );
+  debug_printf("creating aggregate: %s (argc %i, func %i, window %i, status %i)\n", funcname, argc, func, window, last_status);
+  return last_status;
+}
+
+// Delete a custom function.
+int EXPORT(delete_function) (const char* funcname, int argc) {
+  last_status = sqlite3_create_function(database, funcname, argc, 0, NULL, NULL, NULL, NULL);
+  debug_printf("deleting function: %s (status %i)\n", funcname, last_status);
+  return last_status;
 }
 
 // Wrap function return setters. Calling these outside of
@@ -383,7 +818,9 @@ void EXPORT(result_text) (const char* value) {
 }
 
 void EXPORT(result_blob) (void* value, int size) {
-  sqlite3_result_blob(current_ctx, value, size, SQLITE_TRANSIENT /* see `bind_blob` */);
+  // The value is freed by JS once this returns (see `setArr`), so
+  // SQLite has to copy it.
+  sqlite3_result_blob(current_ctx, value, size, SQLITE_TRANSIENT);
   debug_printf("returning blob '%s'\n", value);
 }
 
@@ -429,3 +866,134 @@ int EXPORT(deserialize) (const char* schema, void* data, int bytes, int flags) {
   );
   return last_status;
 }
+
+// Open a blob for incremental I/O. Returns NULL if the
+// blob could not be opened.
+sqlite3_blob* EXPORT(blob_open) (const char* schema, const char* table, const char* column, double row, int write) {
+  sqlite3_blob* blob = NULL;
+  last_status = sqlite3_blob_open(database, schema, table, column, (sqlite3_int64)row, write, &blob);
+  debug_printf("opened blob (table '%s', column '%s', row %lli, status %i)\n", table, column, (sqlite3_int64)row, last_status);
+  return last_status == SQLITE_OK ? blob : NULL;
+}
+
+// Point an open blob to a different row of the same table.
+int EXPORT(blob_reopen) (sqlite3_blob* blob, double row) {
+  last_status = sqlite3_blob_reopen(blob, (sqlite3_int64)row);
+  debug_printf("reopened blob (row %lli, status %i)\n", (sqlite3_int64)row, last_status);
+  return last_status;
+}
+
+int EXPORT(blob_close) (sqlite3_blob* blob) {
+  last_status = sqlite3_blob_close(blob);
+  debug_printf("closed blob (status %i)\n", last_status);
+  return last_status;
+}
+
+int EXPORT(blob_bytes) (sqlite3_blob* blob) {
+  return sqlite3_blob_bytes(blob);
+}
+
+// Staging buffer which holds the data read by `blob_read`,
+// and the data to be written by `blob_write`. The buffer can
+// hold `blob_buffer_bytes` bytes.
+void* EXPORT(blob_buffer) () {
+  return (void*)blob_buffer_data;
+}
+
+int EXPORT(blob_buffer_bytes) () {
+  return BLOB_BUFFER_BYTES;
+}
+
+// Read `size` bytes starting at `offset` from the blob
+// into the staging buffer.
+int EXPORT(blob_read) (sqlite3_blob* blob, int size, int offset) {
+  if (size > BLOB_BUFFER_BYTES) {
+    last_status = SQLITE_MISUSE;
+    return last_status;
+  }
+  last_status = sqlite3_blob_read(blob, blob_buffer_data, size, offset);
+  return last_status;
+}
+
+// Write `size` bytes from the staging buffer to the
+// blob, starting at `offset`.
+int EXPORT(blob_write) (sqlite3_blob* blob, int size, int offset) {
+  if (size > BLOB_BUFFER_BYTES) {
+    last_status = SQLITE_MISUSE;
+    return last_status;
+  }
+  last_status = sqlite3_blob_write(blob, blob_buffer_data, size, offset);
+  return last_status;
+}
+
+// Collect statistics for the database, see `vfs.h` for the
+// I/O counters. These are followed by the current value and
+// high-water mark of each of the memory counters and
+// connection counters listed below. Returns a buffer holding
+// DB_STATS_COUNT doubles. If `reset` is set, the counters and
+// high-water marks are reset after they are read.
+void* EXPORT(db_stats) (int reset) {
+  static const int memory_ops[MEMORY_STATS] = {
+    SQLITE_STATUS_MEMORY_USED,
+    SQLITE_STATUS_MALLOC_COUNT,
+    SQLITE_STATUS_MALLOC_SIZE,
+    SQLITE_STATUS_PAGECACHE_OVERFLOW,
+  };
+  static const int db_status_ops[DB_STATUS_STATS] = {
+    SQLITE_DBSTATUS_CACHE_USED,
+    SQLITE_DBSTATUS_CACHE_HIT,
+    SQLITE_DBSTATUS_CACHE_MISS,
+    SQLITE_DBSTATUS_CACHE_WRITE,
+    SQLITE_DBSTATUS_CACHE_SPILL,
+    SQLITE_DBSTATUS_LOOKASIDE_USED,
+    SQLITE_DBSTATUS_LOOKASIDE_HIT,
+    SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE,
+    SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL,
+    SQLITE_DBSTATUS_SCHEMA_USED,
+    SQLITE_DBSTATUS_STMT_USED,
+  };
+
+  double* stats = db_stats_buf;
+  for (int i = 0; i < VFS_STAT_COUNT; i ++) {
+    *stats++ = vfs_stats[i];
+    if (reset) vfs_stats[i] = 0;
+  }
+  for (int i = 0; i < MEMORY_STATS; i ++) {
+    sqlite3_int64 current = 0, highwater = 0;
+    sqlite3_status64(memory_ops[i], &current, &highwater, reset);
+    *stats++ = (double)current;
+    *stats++ = (double)highwater;
+  }
+  for (int i = 0; i < DB_STATUS_STATS; i ++) {
+    int current = 0, highwater = 0;
+    if (database)
+      sqlite3_db_status(database, db_status_ops[i], &current, &highwater, reset);
+    *stats++ = (double)current;
+    *stats++ = (double)highwater;
+  }
+  return (void*)db_stats_buf;
+}
+
+// Enable or disable timing of file operations, see `vfs.h`.
+void EXPORT(set_io_timing) (int enabled) {
+  vfs_timing = enabled;
+}
+
+// Collect statistics for the statement. Returns a buffer
+// holding the value of each counter listed below as doubles.
+// If `reset` is set, the counters are reset after they are
+// read.
+void* EXPORT(stmt_stats) (sqlite3_stmt* stmt, int reset) {
+  static const int stmt_status_ops[STMT_STATS_COUNT] = {
+    SQLITE_STMTSTATUS_FULLSCAN_STEP,
+    SQLITE_STMTSTATUS_SORT,
+    SQLITE_STMTSTATUS_AUTOINDEX,
+    SQLITE_STMTSTATUS_VM_STEP,
+    SQLITE_STMTSTATUS_REPREPARE,
+    SQLITE_STMTSTATUS_RUN,
+    SQLITE_STMTSTATUS_MEMUSED,
+  };
+  for (int i = 0; i < STMT_STATS_COUNT; i ++)
+    stmt_stats_buf[i] = (double)sqlite3_stmt_status(stmt, stmt_status_ops[i], reset);
+  return (void*)stmt_stats_buf;
+}
@@ -106,6 +106,11 @@ export default function env(inst) {
     js_time: () => {
       return Date.now();
     },
+    // Return a high resolution timestamp in ms, used
+    // to measure time spent in file operations
+    js_now: () => {
+      return performance.now();
+    },
     // Return the timezone offset in minutes for
     // the current locale
     js_timezone: () => {
@@ -137,8 +142,8 @@ export default function env(inst) {
       return 1;
     },
     // Call a user defined SQL function
-    js_call_user_func: (func_idx, arg_count) => {
-      inst.functions[func_idx](arg_count);
+    js_call_user_func: (func_idx, call, state, arg_count, args_ptr) => {
+      inst.functions[func_idx](call, state, arg_count, args_ptr);
     },
   };
 
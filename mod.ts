@@ -1,21 +1,38 @@
 export { DB } from "./src/db.ts";
+export { AsyncDB } from "./src/async.ts";
 export { SqliteError } from "./src/error.ts";
 export { Status } from "./src/constants.ts";
+export { unpackRows } from "./src/query.ts";
 
+export type { AsyncSqliteOptions } from "./src/async.ts";
+export type { SqliteBlob, SqliteBlobOptions } from "./src/blob.ts";
 export type {
+  DatabaseStats,
+  IoStats,
+  LookasideStats,
+  MemoryStats,
+  PageCacheStats,
   SqliteDeserializeOptions,
   SqliteFunctionOptions,
   SqliteOptions,
+  StatementCacheStats,
 } from "./src/db.ts";
 export type {
   ColumnName,
+  PackedRows,
   PreparedQuery,
   QueryParameter,
   QueryParameterSet,
+  QueryStats,
   Row,
   RowObject,
 } from "./src/query.ts";
-export type { SqlFunctionArgument, SqlFunctionResult } from "./src/function.ts";
+export type {
+  SqlAggregate,
+  SqlFunctionArgument,
+  SqlFunctionResult,
+  SqlWindowFunction,
+} from "./src/function.ts";
 
 import { compile } from "./build/sqlite.js";
 await compile();
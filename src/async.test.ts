@@ -0,0 +1,120 @@
+import {
+  assertEquals,
+  assertRejects,
+} from "https://deno.land/std@0.154.0/testing/asserts.ts";
+
+import { AsyncDB, DB, SqliteError, Status } from "../mod.ts";
+
+const TEST_DB = "async_test.db";
+
+async function dbPermissions(path: string): Promise<boolean> {
+  const query = async (name: "read" | "write") =>
+    (await Deno.permissions.query({ name, path })).state ===
+      "granted";
+  return await query("read") && await query("write");
+}
+
+const TEST_DB_PERMISSIONS = await dbPermissions(TEST_DB);
+
+async function deleteDatabase(file: string) {
+  try {
+    await Deno.remove(file);
+  } catch { /* no op */ }
+  try {
+    await Deno.remove(`${file}-journal`);
+  } catch { /* no op */ }
+}
+
+Deno.test("async in-memory database", async function () {
+  const db = await AsyncDB.open();
+  await db.execute("CREATE TABLE test (id INTEGER PRIMARY KEY, name TEXT)");
+  await db.query("INSERT INTO test (name) VALUES (?), (?)", ["Deno", "Land"]);
+  assertEquals(await db.read("SELECT name FROM test ORDER BY id"), [
+    ["Deno"],
+    ["Land"],
+  ]);
+  assertEquals(await db.queryEntries("SELECT id, name FROM test LIMIT 1"), [
+    { id: 1, name: "Deno" },
+  ]);
+
+  const err = await assertRejects(
+    () => db.query("INSERT INTO nope VALUES (1)"),
+    SqliteError,
+  );
+  assertEquals(err.code, Status.SqliteError);
+
+  await db.close();
+  await db.close();
+  assertEquals(db.isClosed, true);
+  await assertRejects(() => db.query("SELECT 1"), SqliteError);
+});
+
+Deno.test(
+  "async reads are spread over reader connections",
+  {
+    ignore: !TEST_DB_PERMISSIONS,
+    permissions: { read: true, write: true },
+  },
+  async function () {
+    await deleteDatabase(TEST_DB);
+    const db = await AsyncDB.open(TEST_DB, { readers: 3 });
+    await db.execute(`
+      CREATE TABLE test (id INTEGER PRIMARY KEY, value INTEGER);
+      WITH RECURSIVE c(x) AS (
+        SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 1000
+      )
+      INSERT INTO test (value) SELECT x FROM c;
+    `);
+
+    const reads = [];
+    for (let i = 0; i < 20; i++) {
+      reads.push(db.read("SELECT sum(value) FROM test WHERE id <= ?", [i]));
+    }
+    const sums = await Promise.all(reads);
+    const expected = Array.from(
+      { length: 20 },
+      (_, i) => i === 0 ? null : (i * (i + 1)) / 2,
+    );
+    assertEquals(sums.map(([[sum]]) => sum), expected);
+
+    // readers see committed writes, but can not write
+    await db.query("UPDATE test SET value = 0");
+    assertEquals(await db.readEntries("SELECT max(value) AS max FROM test"), [
+      { max: 0 },
+    ]);
+    const err = await assertRejects(
+      () => db.read("DELETE FROM test"),
+      SqliteError,
+    );
+    assertEquals(err.code, Status.SqliteReadOnly);
+
+    await db.close();
+    await deleteDatabase(TEST_DB);
+  },
+);
+
+Deno.test(
+  "async databases in WAL mode run reads on the writer",
+  {
+    ignore: !TEST_DB_PERMISSIONS,
+    permissions: { read: true, write: true },
+  },
+  async function () {
+    await deleteDatabase(TEST_DB);
+    const setup = new DB(TEST_DB);
+    setup.query("PRAGMA journal_mode = WAL");
+    setup.execute("CREATE TABLE test (id INTEGER PRIMARY KEY)");
+    setup.close();
+
+    const db = await AsyncDB.open(TEST_DB, { readers: 2 });
+    await db.query("INSERT INTO test (id) VALUES (1), (2)");
+    // would block forever if a reader connection was used
+    assertEquals(await db.read("SELECT count(*) FROM test"), [[2]]);
+    await db.close();
+
+    await deleteDatabase(TEST_DB);
+    try {
+      await Deno.remove(`${TEST_DB}-wal`);
+    } catch { /* no op */ }
+  },
+);
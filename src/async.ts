@@ -0,0 +1,343 @@
+import type { WorkerCall, WorkerResponse } from "./worker.ts";
+import { SqliteError } from "./error.ts";
+import {
+  PackedRows,
+  QueryParameterSet,
+  Row,
+  RowObject,
+  unpackRows,
+} from "./query.ts";
+
+/**
+ * Options for opening an asynchronous database,
+ * see `AsyncDB.open`.
+ */
+export interface AsyncSqliteOptions {
+  /**
+   * Mode in which to open the database for writing.
+   * See `SqliteOptions.mode`; read-only databases
+   * should be opened with `readers` instead.
+   *
+   * `create` is the default if no mode is
+   * specified.
+   */
+  mode?: "write" | "create";
+  /**
+   * Number of read-only connections used by `read`
+   * and `readEntries`. Each runs in its own worker,
+   * so reads can use multiple cores.
+   *
+   * By default, one less than the number of cores
+   * is used (but at least one). In-memory databases
+   * can not be shared between connections, and the
+   * writer keeps databases in WAL mode locked, so for
+   * them all queries run on the writer.
+   */
+  readers?: number;
+  /**
+   * Number of prepared statements cached by each
+   * connection, see `SqliteOptions.statementCacheSize`.
+   */
+  statementCacheSize?: number;
+}
+
+interface PendingCall {
+  resolve: (response: WorkerResponse) => void;
+  reject: (error: Error) => void;
+}
+
+// A connection running in a worker. Calls are sent
+// right away, and queued by the worker.
+class Connection {
+  #worker: Worker;
+  #pending: Map<number, PendingCall>;
+  #nextId: number;
+  #terminated: boolean;
+
+  constructor() {
+    this.#worker = new Worker(new URL("./worker.ts", import.meta.url).href, {
+      type: "module",
+    });
+    this.#pending = new Map();
+    this.#nextId = 0;
+    this.#terminated = false;
+
+    this.#worker.onmessage = (event: MessageEvent<WorkerResponse>) => {
+      const response = event.data;
+      const pending = this.#pending.get(response.id)!;
+      this.#pending.delete(response.id);
+      pending.resolve(response);
+    };
+    this.#worker.onerror = (event: ErrorEvent) => {
+      event.preventDefault();
+      this.#fail(new SqliteError(`Worker failed: ${event.message}`));
+    };
+  }
+
+  #fail(error: Error) {
+    for (const { reject } of this.#pending.values()) reject(error);
+    this.#pending.clear();
+  }
+
+  async send(call: WorkerCall): Promise<WorkerResponse> {
+    if (this.#terminated) {
+      throw new SqliteError("Database was closed.");
+    }
+    const id = this.#nextId++;
+    const response = await new Promise<WorkerResponse>((resolve, reject) => {
+      this.#pending.set(id, { resolve, reject });
+      this.#worker.postMessage({ ...call, id });
+    });
+    if (response.error !== undefined) {
+      throw new SqliteError(response.error.message, response.error.code);
+    }
+    return response;
+  }
+
+  terminate() {
+    this.#terminated = true;
+    this.#worker.terminate();
+    this.#fail(new SqliteError("Database was closed."));
+  }
+}
+
+/**
+ * An asynchronous database handle, which runs its
+ * connections in workers, so queries don't block the
+ * calling thread.
+ *
+ * There is a single connection for writing, which
+ * runs `query`, `queryEntries`, and `execute` in the
+ * order they are called. Reads using `read` and
+ * `readEntries` are spread over a pool of read-only
+ * connections, each handed to the next idle worker.
+ *
+ * Rows are sent back from the workers in large binary
+ * batches (see `PreparedQuery.allPacked`), and decoded
+ * on the calling thread.
+ *
+ * Connections coordinate using file locks. Reads run
+ * in parallel with each other, but wait while the writer
+ * is in a write transaction, and the writer waits for
+ * running reads before it starts one. The WAL journal
+ * mode keeps the database locked by the writer, so
+ * databases in WAL mode are opened without readers,
+ * and WAL mode should not be enabled after opening.
+ */
+export class AsyncDB {
+  #writer: Connection;
+  #readers: Array<Connection>;
+  #idle: Array<Connection>;
+  #waiting: Array<(reader: Connection) => void>;
+  #open: boolean;
+
+  /**
+   * This constructor should never be used directly.
+   * Instead a database can be opened by calling
+   * `AsyncDB.open`.
+   */
+  constructor(writer: Connection, readers: Array<Connection>) {
+    this.#writer = writer;
+    this.#readers = readers;
+    this.#idle = [...readers];
+    this.#waiting = [];
+    this.#open = true;
+  }
+
+  /**
+   * Open the database at the given path. The writer
+   * connection is opened first (creating the file
+   * according to `mode`), followed by the readers.
+   *
+   * # Example
+   *
+   * ```typescript
+   * const db = await AsyncDB.open("app.db", { readers: 4 });
+   * await db.query("INSERT INTO events (name) VALUES (?)", [name]);
+   * const rows = await db.read("SELECT name FROM events");
+   * await db.close();
+   * ```
+   */
+  static async open(
+    path: string = ":memory:",
+    options: AsyncSqliteOptions = {},
+  ): Promise<AsyncDB> {
+    const memory = path === ":memory:" || path === "";
+    let readerCount = memory
+      ? 0
+      : options.readers ?? Math.max(navigator.hardwareConcurrency - 1, 1);
+    const statementCacheSize = options.statementCacheSize;
+
+    const writer = new Connection();
+    const readers: Array<Connection> = [];
+    try {
+      await writer.send({
+        type: "open",
+        path,
+        options: { mode: options.mode ?? "create", statementCacheSize },
+      });
+      if (readerCount > 0) {
+        // The journal mode is stored in the database file. In WAL
+        // mode the writer holds on to an exclusive lock, which
+        // would block the readers forever.
+        const { rows } = await writer.send({
+          type: "query",
+          sql: "PRAGMA journal_mode",
+        });
+        const [[mode]] = unpackRows<[string]>(rows!);
+        if (mode.toLowerCase() === "wal") readerCount = 0;
+      }
+      for (let i = 0; i < readerCount; i++) readers.push(new Connection());
+      await Promise.all(readers.map((reader) =>
+        reader.send({
+          type: "open",
+          path,
+          options: { mode: "read", statementCacheSize },
+        })
+      ));
+    } catch (error) {
+      writer.terminate();
+      readers.forEach((reader) => reader.terminate());
+      throw error;
+    }
+    return new AsyncDB(writer, readers);
+  }
+
+  #ensureOpen() {
+    if (!this.#open) {
+      throw new SqliteError("Database was closed.");
+    }
+  }
+
+  async #takeReader(): Promise<Connection> {
+    if (this.#readers.length === 0) return this.#writer;
+    return this.#idle.pop() ??
+      await new Promise<Connection>((resolve) => this.#waiting.push(resolve));
+  }
+
+  #returnReader(reader: Connection) {
+    if (reader === this.#writer) return;
+    const next = this.#waiting.shift();
+    if (next !== undefined) {
+      next(reader);
+    } else {
+      this.#idle.push(reader);
+    }
+  }
+
+  async #query(
+    connection: Connection,
+    sql: string,
+    params?: QueryParameterSet,
+  ) {
+    const { rows } = await connection.send({ type: "query", sql, params });
+    return rows!;
+  }
+
+  /**
+   * Run a query on the writer connection and return
+   * all matching rows, see `DB.query`.
+   */
+  async query<R extends Row = Row>(
+    sql: string,
+    params?: QueryParameterSet,
+  ): Promise<Array<R>> {
+    this.#ensureOpen();
+    return unpackRows<R>(await this.#query(this.#writer, sql, params));
+  }
+
+  /**
+   * Like `query` except each row is returned as
+   * an object containing key-value pairs.
+   */
+  async queryEntries<O extends RowObject = RowObject>(
+    sql: string,
+    params?: QueryParameterSet,
+  ): Promise<Array<O>> {
+    this.#ensureOpen();
+    return toEntries<O>(await this.#query(this.#writer, sql, params));
+  }
+
+  /**
+   * Run a read-only query on the next idle reader
+   * connection and return all matching rows. Queries
+   * which modify the database fail.
+   */
+  async read<R extends Row = Row>(
+    sql: string,
+    params?: QueryParameterSet,
+  ): Promise<Array<R>> {
+    this.#ensureOpen();
+    const reader = await this.#takeReader();
+    try {
+      return unpackRows<R>(await this.#query(reader, sql, params));
+    } finally {
+      this.#returnReader(reader);
+    }
+  }
+
+  /**
+   * Like `read` except each row is returned as
+   * an object containing key-value pairs.
+   */
+  async readEntries<O extends RowObject = RowObject>(
+    sql: string,
+    params?: QueryParameterSet,
+  ): Promise<Array<O>> {
+    this.#ensureOpen();
+    const reader = await this.#takeReader();
+    try {
+      return toEntries<O>(await this.#query(reader, sql, params));
+    } finally {
+      this.#returnReader(reader);
+    }
+  }
+
+  /**
+   * Run multiple semicolon-separated statements on
+   * the writer connection, see `DB.execute`.
+   */
+  async execute(sql: string) {
+    this.#ensureOpen();
+    await this.#writer.send({ type: "execute", sql });
+  }
+
+  /**
+   * Close all connections and stop their workers.
+   * Queries already sent to a worker finish first,
+   * reads still waiting for an idle reader fail.
+   *
+   * `close` may safely be called multiple
+   * times.
+   */
+  async close() {
+    if (!this.#open) {
+      return;
+    }
+    this.#open = false;
+    const connections = [this.#writer, ...this.#readers];
+    try {
+      await Promise.all(connections.map((connection) =>
+        connection.send({ type: "close" })
+      ));
+    } finally {
+      connections.forEach((connection) => connection.terminate());
+    }
+  }
+
+  /**
+   * Returns `true` when the database handle is closed
+   * and can no longer be used.
+   */
+  get isClosed(): boolean {
+    return !this.#open;
+  }
+}
+
+function toEntries<O extends RowObject>(packed: PackedRows): Array<O> {
+  return unpackRows(packed).map((row) => {
+    const entry: RowObject = {};
+    packed.columns.forEach((name, idx) => entry[name] = row[idx]);
+    return entry as O;
+  });
+}
@@ -0,0 +1,152 @@
+import {
+  assertEquals,
+  assertThrows,
+} from "https://deno.land/std@0.154.0/testing/asserts.ts";
+
+import { DB, SqliteError, Status } from "../mod.ts";
+
+function fill(size: number): Uint8Array {
+  const data = new Uint8Array(size);
+  for (let i = 0; i < size; i++) data[i] = (i * 7) % 251;
+  return data;
+}
+
+Deno.test("blobs can be read and written in chunks", function () {
+  const db = new DB();
+  db.query("CREATE TABLE files (id INTEGER PRIMARY KEY, data BLOB)");
+  // larger than the staging buffer, so writes are split
+  const data = fill(200_000);
+  db.query("INSERT INTO files (data) VALUES (zeroblob(?))", [data.length]);
+
+  const blob = db.openBlob({
+    table: "files",
+    column: "data",
+    row: db.lastInsertRowId,
+    mode: "write",
+  });
+  assertEquals(blob.byteLength, data.length);
+  assertEquals(blob.writeSync(data.subarray(0, 1000)), 1000);
+  assertEquals(blob.writeSync(data.subarray(1000)), data.length - 1000);
+  assertEquals(blob.position, data.length);
+
+  blob.position = 0;
+  const read = new Uint8Array(data.length + 10);
+  assertEquals(blob.readSync(read), data.length);
+  assertEquals(blob.readSync(read), null);
+  blob.close();
+
+  assertEquals(read.subarray(0, data.length), data);
+  assertEquals(db.query("SELECT data FROM files"), [[data]]);
+});
+
+Deno.test("blobs can be streamed", async function () {
+  const db = new DB();
+  db.query("CREATE TABLE files (id INTEGER PRIMARY KEY, data BLOB)");
+  const data = fill(150_000);
+  db.query("INSERT INTO files (data) VALUES (zeroblob(?))", [data.length]);
+  const options = {
+    table: "files",
+    column: "data",
+    row: db.lastInsertRowId,
+  };
+
+  const writer = db.openBlob({ ...options, mode: "write" });
+  const source = new ReadableStream({
+    start(controller) {
+      controller.enqueue(data.subarray(0, 100_000));
+      controller.enqueue(data.subarray(100_000));
+      controller.close();
+    },
+  });
+  await source.pipeTo(writer.writable);
+  writer.close();
+
+  const reader = db.openBlob(options);
+  const chunks = [];
+  for await (const chunk of reader.readable) chunks.push(chunk);
+  reader.close();
+
+  const read = new Uint8Array(data.length);
+  let offset = 0;
+  for (const chunk of chunks) {
+    read.set(chunk, offset);
+    offset += chunk.length;
+  }
+  assertEquals(chunks.length > 1, true);
+  assertEquals(read, data);
+});
+
+Deno.test("blobs can be reopened on a different row", function () {
+  const db = new DB();
+  db.query("CREATE TABLE files (id INTEGER PRIMARY KEY, data BLOB)");
+  db.query("INSERT INTO files (id, data) VALUES (1, ?), (2, ?)", [
+    new Uint8Array([1, 2, 3]),
+    new Uint8Array([4, 5]),
+  ]);
+
+  const blob = db.openBlob({ table: "files", column: "data", row: 1 });
+  const read = new Uint8Array(3);
+  assertEquals(blob.readSync(read), 3);
+  assertEquals(read, new Uint8Array([1, 2, 3]));
+
+  blob.reopen(2);
+  assertEquals(blob.byteLength, 2);
+  assertEquals(blob.readSync(read), 2);
+  assertEquals(read.subarray(0, 2), new Uint8Array([4, 5]));
+  assertThrows(() => blob.reopen(3), SqliteError);
+  blob.close();
+});
+
+Deno.test("invalid blob operations throw", function () {
+  const db = new DB();
+  db.query("CREATE TABLE files (id INTEGER PRIMARY KEY, data BLOB)");
+  db.query("INSERT INTO files (data) VALUES (zeroblob(4))");
+
+  assertThrows(() => db.openBlob({ table: "files", column: "data", row: 2 }));
+  assertThrows(() => db.openBlob({ table: "nope", column: "data", row: 1 }));
+
+  const blob = db.openBlob({ table: "files", column: "data", row: 1 });
+  const err = assertThrows(
+    () => blob.writeSync(new Uint8Array(1)),
+    SqliteError,
+  );
+  assertEquals(err.code, Status.SqliteReadOnly);
+  assertThrows(() => (blob.position = 5), SqliteError);
+  blob.close();
+  blob.close();
+  assertThrows(() => blob.readSync(new Uint8Array(1)), SqliteError);
+
+  const writer = db.openBlob({
+    table: "files",
+    column: "data",
+    row: 1,
+    mode: "write",
+  });
+  assertThrows(() => writer.writeSync(new Uint8Array(5)), SqliteError);
+
+  // the handle expires once its row is changed
+  db.query("UPDATE files SET data = zeroblob(4) WHERE id = 1");
+  const expired = assertThrows(
+    () => writer.writeSync(new Uint8Array(1)),
+    SqliteError,
+  );
+  assertEquals(expired.code, Status.SqliteAbort);
+  writer.close();
+});
+
+Deno.test("open blobs block close", function () {
+  const db = new DB();
+  db.query("CREATE TABLE files (id INTEGER PRIMARY KEY, data BLOB)");
+  db.query("INSERT INTO files (data) VALUES (zeroblob(4))");
+  db.openBlob({ table: "files", column: "data", row: 1 });
+
+  assertThrows(() => db.close());
+  db.close(true);
+});
+
+Deno.test("empty blobs are bound as blobs", function () {
+  const db = new DB();
+  assertEquals(db.query("SELECT typeof(?), length(?1)", [new Uint8Array()]), [
+    ["blob", 0],
+  ]);
+});
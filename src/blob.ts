@@ -0,0 +1,296 @@
+import { BlobPtr, Wasm } from "../build/sqlite.js";
+import { Status } from "./constants.ts";
+import { SqliteError } from "./error.ts";
+
+/**
+ * Options for opening a blob for incremental
+ * I/O, see `DB.openBlob`.
+ */
+export interface SqliteBlobOptions {
+  /** Name of the table containing the blob. */
+  table: string;
+  /** Name of the column containing the blob. */
+  column: string;
+  /** Row id of the row containing the blob. */
+  row: number;
+  /**
+   * Name of the database schema containing the
+   * table. The default is `main`.
+   */
+  schema?: "main" | "temp" | string;
+  /**
+   * Mode in which to open the blob.
+   *
+   * - `read`: the blob can only be read
+   *
+   * - `write`: the blob can be read and written
+   *
+   * `read` is the default if no mode is
+   * specified.
+   */
+  mode?: "read" | "write";
+}
+
+/**
+ * A handle to a single BLOB value, which can be
+ * read and written incrementally, without holding
+ * the whole value in memory.
+ *
+ * Data is moved in chunks through a small, fixed
+ * buffer. The handle tracks a position, which is
+ * advanced by reads and writes, and implements
+ * `Deno.Reader`, `Deno.ReaderSync`, `Deno.Writer`,
+ * and `Deno.WriterSync`.
+ *
+ * A blob can not change its size. To store a large
+ * value, first insert a zero-filled blob of the final
+ * size using the SQL function `zeroblob(N)`, and then
+ * write to it. SQLite stores this blob without
+ * allocating `N` bytes of memory.
+ *
+ * If the row containing the blob is modified or
+ * deleted, the handle expires and all further reads
+ * and writes fail. The handle may be pointed to a
+ * different row using `reopen`.
+ *
+ * Blob handles must be closed by calling `close`
+ * once they are no longer needed.
+ */
+export class SqliteBlob {
+  #wasm: Wasm;
+  #blob: BlobPtr;
+  #openBlobs: Set<BlobPtr>;
+  #writable: boolean;
+  #position: number;
+  #closed: boolean;
+
+  /**
+   * This constructor should never be used directly.
+   * Instead a blob can be opened by calling
+   * `DB.openBlob`.
+   */
+  constructor(
+    wasm: Wasm,
+    blob: BlobPtr,
+    openBlobs: Set<BlobPtr>,
+    writable: boolean,
+  ) {
+    this.#wasm = wasm;
+    this.#blob = blob;
+    this.#openBlobs = openBlobs;
+    this.#writable = writable;
+    this.#position = 0;
+    this.#closed = false;
+  }
+
+  #ensureOpen() {
+    if (this.#closed) {
+      throw new SqliteError("Blob was closed.");
+    }
+  }
+
+  /**
+   * Size of the blob in bytes.
+   */
+  get byteLength(): number {
+    this.#ensureOpen();
+    return this.#wasm.blob_bytes(this.#blob);
+  }
+
+  /**
+   * Offset in bytes at which the next read or
+   * write starts.
+   */
+  get position(): number {
+    return this.#position;
+  }
+
+  set position(position: number) {
+    if (
+      !Number.isInteger(position) || position < 0 ||
+      position > this.byteLength
+    ) {
+      throw new SqliteError(`Invalid blob position ${position}.`);
+    }
+    this.#position = position;
+  }
+
+  /**
+   * Read up to `p.byteLength` bytes into `p`, starting
+   * at the current position. Returns the number of bytes
+   * read, or `null` once the end of the blob is reached.
+   */
+  readSync(p: Uint8Array): number | null {
+    const size = Math.min(p.byteLength, this.byteLength - this.#position);
+    if (size <= 0) {
+      return p.byteLength === 0 ? 0 : null;
+    }
+
+    const buffer = this.#wasm.blob_buffer();
+    const chunkSize = this.#wasm.blob_buffer_bytes();
+    for (let offset = 0; offset < size; offset += chunkSize) {
+      const chunk = Math.min(chunkSize, size - offset);
+      const status = this.#wasm.blob_read(
+        this.#blob,
+        chunk,
+        this.#position + offset,
+      );
+      if (status !== Status.SqliteOk) {
+        throw new SqliteError(this.#wasm, status);
+      }
+      p.set(new Uint8Array(this.#wasm.memory.buffer, buffer, chunk), offset);
+    }
+    this.#position += size;
+    return size;
+  }
+
+  /**
+   * Write all of `p` to the blob, starting at the
+   * current position. Returns the number of bytes
+   * written.
+   *
+   * This throws if the write would extend past the
+   * end of the blob, or if the blob was opened in
+   * `read` mode.
+   */
+  writeSync(p: Uint8Array): number {
+    if (!this.#writable) {
+      throw new SqliteError(
+        "Blob was opened read-only.",
+        Status.SqliteReadOnly,
+      );
+    }
+    if (this.#position + p.byteLength > this.byteLength) {
+      throw new SqliteError("Write exceeds the size of the blob.");
+    }
+
+    const buffer = this.#wasm.blob_buffer();
+    const chunkSize = this.#wasm.blob_buffer_bytes();
+    for (let offset = 0; offset < p.byteLength; offset += chunkSize) {
+      const chunk = p.subarray(offset, offset + chunkSize);
+      new Uint8Array(this.#wasm.memory.buffer, buffer, chunk.byteLength)
+        .set(chunk);
+      const status = this.#wasm.blob_write(
+        this.#blob,
+        chunk.byteLength,
+        this.#position + offset,
+      );
+      if (status !== Status.SqliteOk) {
+        throw new SqliteError(this.#wasm, status);
+      }
+    }
+    this.#position += p.byteLength;
+    return p.byteLength;
+  }
+
+  /**
+   * Like `readSync`, for use where a `Deno.Reader`
+   * is expected.
+   */
+  read(p: Uint8Array): Promise<number | null> {
+    try {
+      return Promise.resolve(this.readSync(p));
+    } catch (error) {
+      return Promise.reject(error);
+    }
+  }
+
+  /**
+   * Like `writeSync`, for use where a `Deno.Writer`
+   * is expected.
+   */
+  write(p: Uint8Array): Promise<number> {
+    try {
+      return Promise.resolve(this.writeSync(p));
+    } catch (error) {
+      return Promise.reject(error);
+    }
+  }
+
+  /**
+   * A stream of the contents of the blob, from the
+   * current position to the end. The stream is pulled
+   * in chunks, so only a small part of the blob is
+   * held in memory at any time.
+   *
+   * # Example
+   *
+   * ```typescript
+   * const file = await Deno.create("photo.jpg");
+   * await blob.readable.pipeTo(file.writable);
+   * ```
+   */
+  get readable(): ReadableStream<Uint8Array> {
+    const chunkSize = this.#wasm.blob_buffer_bytes();
+    return new ReadableStream({
+      pull: (controller) => {
+        const chunk = new Uint8Array(chunkSize);
+        const size = this.readSync(chunk);
+        if (size === null) {
+          controller.close();
+        } else {
+          controller.enqueue(chunk.subarray(0, size));
+        }
+      },
+    });
+  }
+
+  /**
+   * A stream which writes to the blob, starting at
+   * the current position. Closing the stream does not
+   * close the blob.
+   *
+   * # Example
+   *
+   * ```typescript
+   * const { size } = await Deno.stat("photo.jpg");
+   * db.query("INSERT INTO photos (data) VALUES (zeroblob(?))", [size]);
+   * const blob = db.openBlob({
+   *   table: "photos",
+   *   column: "data",
+   *   row: db.lastInsertRowId,
+   *   mode: "write",
+   * });
+   * const file = await Deno.open("photo.jpg");
+   * await file.readable.pipeTo(blob.writable);
+   * blob.close();
+   * ```
+   */
+  get writable(): WritableStream<Uint8Array> {
+    return new WritableStream({
+      write: (chunk) => {
+        this.writeSync(chunk);
+      },
+    });
+  }
+
+  /**
+   * Point the handle to the blob in a different row
+   * of the same table and column. This is faster than
+   * opening a new handle. The position is reset to
+   * the start of the blob.
+   */
+  reopen(row: number) {
+    this.#ensureOpen();
+    const status = this.#wasm.blob_reopen(this.#blob, row);
+    if (status !== Status.SqliteOk) {
+      throw new SqliteError(this.#wasm, status);
+    }
+    this.#position = 0;
+  }
+
+  /**
+   * Close the blob handle. This must be called once
+   * the handle is no longer used.
+   *
+   * `close` may safely be called multiple
+   * times.
+   */
+  close() {
+    if (!this.#closed) {
+      this.#wasm.blob_close(this.#blob);
+      this.#openBlobs.delete(this.#blob);
+      this.#closed = true;
+    }
+  }
+}
@@ -91,6 +91,14 @@ export enum FunctionFlags {
   DirectOnly = 0x000080000,
 }
 
+export enum FunctionCalls {
+  Scalar = 0,
+  Step = 1,
+  Final = 2,
+  Value = 3,
+  Inverse = 4,
+}
+
 export enum Types {
   Integer = 1,
   Float = 2,
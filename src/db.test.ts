@@ -30,6 +30,9 @@ async function deleteDatabase(file: string) {
   try {
     await Deno.remove(`${file}-journal`);
   } catch { /* no op */ }
+  try {
+    await Deno.remove(`${file}-wal`);
+  } catch { /* no op */ }
 }
 
 Deno.test("execute multiple statements", function () {
@@ -244,6 +247,86 @@ Deno.test("open queries cleaned up by forced close", function () {
   db.close(true);
 });
 
+Deno.test("statement cache re-uses prepared statements", function () {
+  const db = new DB(":memory:", { statementCacheSize: 2 });
+  db.query("CREATE TABLE test (id INTEGER PRIMARY KEY, name TEXT)");
+  const insert = "INSERT INTO test (name) VALUES (?)";
+  for (const name of ["Peter", "Clark", "Bruce"]) {
+    db.query(insert, [name]);
+  }
+  assertEquals(db.queryEntries("SELECT name FROM test WHERE id = ?", [2]), [
+    { name: "Clark" },
+  ]);
+  assertEquals(db.query("SELECT count(*) FROM test"), [[3]]);
+
+  // the insert statement was evicted by the two selects
+  db.query(insert, ["Diana"]);
+  assertEquals(db.statementCacheStats, {
+    hits: 2,
+    misses: 5,
+    size: 2,
+    capacity: 2,
+  });
+
+  // cached statements don't block closing the database
+  db.close();
+});
+
+Deno.test("statement cache handles nested queries", function () {
+  const db = new DB(":memory:", { statementCacheSize: 8 });
+  db.query("CREATE TABLE test (id INTEGER PRIMARY KEY)");
+  db.query("INSERT INTO test (id) VALUES (1), (2), (3)");
+  // the function runs the same SQL while the outer query is active
+  const sql = "SELECT count_below(id) FROM test WHERE id <= ?";
+  db.createFunction((id: number) => db.query(sql, [id - 1]).length, {
+    name: "count_below",
+  });
+  assertEquals(db.query(sql, [3]), [[0], [1], [2]]);
+  assertEquals(db.query(sql, [3]), [[0], [1], [2]]);
+  db.close();
+});
+
+Deno.test("statement cache picks up schema changes", function () {
+  const db = new DB(":memory:", { statementCacheSize: 4 });
+  db.query("CREATE TABLE test (id INTEGER PRIMARY KEY)");
+  db.query("INSERT INTO test (id) VALUES (1)");
+  assertEquals(db.queryEntries("SELECT * FROM test"), [{ id: 1 }]);
+  db.query("ALTER TABLE test ADD COLUMN name TEXT DEFAULT 'Peter'");
+  assertEquals(db.queryEntries("SELECT * FROM test"), [
+    { id: 1, name: "Peter" },
+  ]);
+  db.close();
+});
+
+Deno.test("database stats report memory and cache usage", function () {
+  const db = new DB(":memory:", { statementCacheSize: 4 });
+  db.query("CREATE TABLE test (id INTEGER PRIMARY KEY, name TEXT)");
+  db.query("INSERT INTO test (name) VALUES ('Peter'), ('Clark')");
+  db.query("SELECT name FROM test");
+  db.query("SELECT name FROM test");
+
+  const stats = db.stats(true);
+  assert(stats.memory.used > 0);
+  assert(stats.memory.highwater >= stats.memory.used);
+  assert(stats.memory.schema > 0);
+  assert(stats.memory.statements > 0);
+  assert(stats.pageCache.used > 0);
+  assertEquals(stats.io.jsWrites, 0);
+  assertEquals(stats.statementCache.hits, 1);
+  assertEquals(stats.statementCache.misses, 3);
+
+  // counters start again from zero after a reset
+  assertEquals(db.stats().statementCache, {
+    hits: 0,
+    misses: 0,
+    size: 3,
+    capacity: 4,
+  });
+
+  db.close();
+  assertThrows(() => db.stats());
+});
+
 Deno.test("invalid bind does not leak statements", function () {
   const db = new DB();
   db.query("CREATE TABLE test (id INTEGER)");
@@ -469,6 +552,98 @@ Deno.test(
   },
 );
 
+Deno.test(
+  "large transactions persist to file",
+  {
+    ignore: !TEST_DB_PERMISSIONS,
+    permissions: { read: true, write: true },
+    sanitizeResources: true,
+  },
+  async function () {
+    await deleteDatabase(TEST_DB);
+
+    const db = new DB(TEST_DB);
+    db.execute("PRAGMA cache_size = 10");
+    db.execute("CREATE TABLE test (id INTEGER PRIMARY KEY, val BLOB)");
+    const insert = db.prepareQuery("INSERT INTO test (val) VALUES (?)");
+    db.transaction(() => {
+      for (let i = 0; i < 1000; i++) {
+        insert.execute([new Uint8Array(1000).fill(i % 256)]);
+      }
+    });
+    insert.finalize();
+    // roll back a transaction which touches the same pages
+    assertThrows(() =>
+      db.transaction(() => {
+        db.execute("UPDATE test SET val = zeroblob(1000)");
+        throw new Error("roll back");
+      })
+    );
+    db.close();
+
+    const reopenedDb = new DB(TEST_DB);
+    const rows = reopenedDb.query<[number, Uint8Array]>(
+      "SELECT id, val FROM test",
+    );
+    assertEquals(rows.length, 1000);
+    for (const [id, val] of rows) {
+      assertEquals(val, new Uint8Array(1000).fill((id - 1) % 256));
+    }
+    assertEquals(reopenedDb.query("PRAGMA integrity_check"), [["ok"]]);
+    reopenedDb.close();
+
+    await deleteDatabase(TEST_DB);
+  },
+);
+
+Deno.test(
+  "WAL mode database checkpoints and recovers",
+  {
+    ignore: !TEST_DB_PERMISSIONS,
+    permissions: { read: true, write: true },
+    sanitizeResources: true,
+  },
+  async function () {
+    const data = ["Hello World!", "Hello Deno!", "JavaScript <3"];
+    const rows = data.map((val) => [val]);
+    const crashDb = `crashed_${TEST_DB}`;
+    await deleteDatabase(TEST_DB);
+    await deleteDatabase(crashDb);
+
+    const db = new DB(TEST_DB);
+    assertEquals(db.query("PRAGMA journal_mode = WAL"), [["wal"]]);
+    db.execute(
+      "CREATE TABLE test (id INTEGER PRIMARY KEY AUTOINCREMENT, val TEXT)",
+    );
+    for (const val of data) {
+      db.query("INSERT INTO test (val) VALUES (?)", [val]);
+    }
+    assert((await Deno.stat(`${TEST_DB}-wal`)).size > 0);
+
+    // simulate a crash by copying the files of the open database
+    await Deno.copyFile(TEST_DB, crashDb);
+    await Deno.copyFile(`${TEST_DB}-wal`, `${crashDb}-wal`);
+
+    // a checkpoint moves all pages into the database file
+    assertEquals(db.query("PRAGMA wal_checkpoint(TRUNCATE)"), [[0, 0, 0]]);
+    assertEquals((await Deno.stat(`${TEST_DB}-wal`)).size, 0);
+    db.close();
+
+    const reopenedDb = new DB(TEST_DB);
+    assertEquals(reopenedDb.query("SELECT val FROM test"), rows);
+    reopenedDb.close();
+
+    // committed transactions are recovered from the WAL
+    const recoveredDb = new DB(crashDb);
+    assertEquals(recoveredDb.query("PRAGMA journal_mode"), [["wal"]]);
+    assertEquals(recoveredDb.query("SELECT val FROM test"), rows);
+    recoveredDb.close();
+
+    await deleteDatabase(TEST_DB);
+    await deleteDatabase(crashDb);
+  },
+);
+
 Deno.test(
   "database open options",
   {
@@ -569,3 +744,42 @@ Deno.test(
     db.close();
   },
 );
+
+Deno.test(
+  "database stats count file I/O",
+  {
+    ignore: !TEST_DB_PERMISSIONS,
+    permissions: { read: true, write: true },
+    sanitizeResources: true,
+  },
+  async function () {
+    await deleteDatabase(TEST_DB);
+
+    const db = new DB(TEST_DB);
+    db.execute("CREATE TABLE test (id INTEGER PRIMARY KEY, val BLOB)");
+    db.stats(true);
+    db.query("INSERT INTO test (val) VALUES (?)", [new Uint8Array(10000)]);
+
+    const { io } = db.stats(true);
+    assert(io.writes > 0);
+    assert(io.syncs > 0);
+    assert(io.bytesWritten >= 10000);
+    // writes are buffered before they are passed on
+    assert(io.jsWrites > 0 && io.jsWrites <= io.writes);
+    assert(io.jsCalls >= io.jsReads + io.jsWrites);
+    // file operations are only timed on request
+    assertEquals(io.jsTime, 0);
+    assertEquals(db.stats().io.writes, 0);
+    db.close();
+
+    // each insert commits (and syncs) separately, which takes
+    // long enough to register even with a coarse clock
+    const timed = new DB(TEST_DB, { ioTiming: true });
+    for (let i = 0; i < 20; i++) {
+      timed.query("INSERT INTO test (val) VALUES (?)", [new Uint8Array(10000)]);
+    }
+    assert(timed.stats().io.jsTime > 0);
+    timed.close();
+    await deleteDatabase(TEST_DB);
+  },
+);
@@ -1,4 +1,4 @@
-import { instantiate, StatementPtr, Wasm } from "../build/sqlite.js";
+import { BlobPtr, instantiate, StatementPtr, Wasm } from "../build/sqlite.js";
 import { setStr } from "./wasm.ts";
 import {
   DeserializeFlags,
@@ -8,11 +8,22 @@ import {
   Values,
 } from "./constants.ts";
 import { SqliteError } from "./error.ts";
-import { PreparedQuery, QueryParameterSet, Row, RowObject } from "./query.ts";
+import { SqliteBlob, SqliteBlobOptions } from "./blob.ts";
 import {
+  PackedRows,
+  PreparedQuery,
+  QueryParameterSet,
+  Row,
+  RowObject,
+} from "./query.ts";
+import {
+  SqlAggregate,
   SqlFunction,
   SqlFunctionArgument,
   SqlFunctionResult,
+  SqlWindowFunction,
+  UserFunction,
+  wrapSqlAggregate,
   wrapSqlFunction,
 } from "./function.ts";
 
@@ -50,8 +61,155 @@ export interface SqliteOptions {
    * for more information.
    */
   uri?: boolean;
+  /**
+   * Number of prepared statements kept around
+   * by `query` and `queryEntries` for re-use,
+   * keyed by their SQL text. Re-using a statement
+   * avoids parsing and planning the same SQL again.
+   *
+   * The least recently used statement is finalized
+   * once the cache is full. By default no statements
+   * are cached.
+   */
+  statementCacheSize?: number;
+  /**
+   * Measure the time spent in file operations,
+   * which is reported as `IoStats.jsTime`. Timing
+   * adds some overhead to every operation, so it
+   * is disabled by default.
+   */
+  ioTiming?: boolean;
+}
+
+/**
+ * Statistics for the statement cache of a
+ * database, see `SqliteOptions.statementCacheSize`.
+ */
+export interface StatementCacheStats {
+  /** Number of statements served from the cache. */
+  hits: number;
+  /** Number of statements which had to be prepared. */
+  misses: number;
+  /** Number of statements currently cached. */
+  size: number;
+  /** Maximum number of statements cached. */
+  capacity: number;
+}
+
+/**
+ * File I/O statistics of a database, counted
+ * across all files (database, journal, etc.)
+ * opened for it.
+ */
+export interface IoStats {
+  /** Number of reads requested by SQLite. */
+  reads: number;
+  /** Number of writes requested by SQLite. */
+  writes: number;
+  /** Number of syncs requested by SQLite. */
+  syncs: number;
+  /** Number of bytes read by SQLite. */
+  bytesRead: number;
+  /** Number of bytes written by SQLite. */
+  bytesWritten: number;
+  /**
+   * Number of file operations (including reads,
+   * writes, locks, and size queries) performed
+   * in JavaScript. Reads and writes are buffered,
+   * so this is usually lower than the number
+   * requested by SQLite.
+   */
+  jsCalls: number;
+  /** Number of reads performed in JavaScript. */
+  jsReads: number;
+  /** Number of writes performed in JavaScript. */
+  jsWrites: number;
+  /**
+   * Time spent in file operations, in milliseconds.
+   * This is always zero unless `SqliteOptions.ioTiming`
+   * is set.
+   */
+  jsTime: number;
 }
 
+/**
+ * Page cache statistics of a database.
+ */
+export interface PageCacheStats {
+  /** Bytes of memory used by the page cache. */
+  used: number;
+  /** Number of pages found in the page cache. */
+  hits: number;
+  /** Number of pages which had to be read from disk. */
+  misses: number;
+  /** Number of pages written to disk. */
+  writes: number;
+  /**
+   * Number of dirty pages written to disk in the
+   * middle of a transaction, because the page cache
+   * was full.
+   */
+  spills: number;
+}
+
+/**
+ * Lookaside memory statistics of a database. The
+ * lookaside allocator serves small allocations made
+ * by the database connection.
+ */
+export interface LookasideStats {
+  /** Number of lookaside slots in use. */
+  used: number;
+  /** Largest number of lookaside slots in use. */
+  highwater: number;
+  /** Number of allocations served by the lookaside allocator. */
+  hits: number;
+  /** Number of allocations which were too large for a slot. */
+  missesSize: number;
+  /** Number of allocations which found all slots in use. */
+  missesFull: number;
+}
+
+/**
+ * Memory statistics of a database, in bytes unless
+ * noted otherwise.
+ */
+export interface MemoryStats {
+  /** Heap memory in use. */
+  used: number;
+  /** Largest amount of heap memory in use. */
+  highwater: number;
+  /** Number of heap allocations in use. */
+  allocations: number;
+  /** Largest number of heap allocations in use. */
+  allocationsHighwater: number;
+  /** Size of the largest heap allocation. */
+  largestAllocation: number;
+  /** Heap memory used by the page cache. */
+  pageCache: number;
+  /** Largest amount of heap memory used by the page cache. */
+  pageCacheHighwater: number;
+  /** Memory used to store the database schema. */
+  schema: number;
+  /** Memory used by prepared statements. */
+  statements: number;
+}
+
+/**
+ * Performance statistics of a database, see
+ * `DB.stats`.
+ */
+export interface DatabaseStats {
+  io: IoStats;
+  pageCache: PageCacheStats;
+  lookaside: LookasideStats;
+  memory: MemoryStats;
+  statementCache: StatementCacheStats;
+}
+
+// Number of values returned by the `db_stats` export, see `wrapper.c`
+const DB_STATS_COUNT = 39;
+
 /**
  * Options for opening a database from an in-memory
  * buffer.
@@ -100,6 +258,9 @@ export interface SqliteFunctionOptions {
    * ```
    *
    * would all be called `foo` on the SQL side.
+   *
+   * Aggregate and window functions have no name
+   * to infer, so this argument is required for them.
    */
   name?: string;
   /**
@@ -136,11 +297,16 @@ export interface SqliteFunctionOptions {
  */
 export class DB {
   #wasm: Wasm;
-  #functions: Array<(argc: number) => void>;
+  #functions: Array<UserFunction>;
   #open: boolean;
 
   #statements: Set<StatementPtr>;
-  #functionNames: Map<string, number>;
+  #blobs: Set<BlobPtr>;
+  #statementCache: Map<string, PreparedQuery>;
+  #statementCacheSize: number;
+  #statementCacheHits: number;
+  #statementCacheMisses: number;
+  #functionNames: Map<string, { funcIdx: number; argc: number }>;
   #transactionDepth: number;
 
   /**
@@ -177,6 +343,11 @@ export class DB {
     this.#open = false;
 
     this.#statements = new Set();
+    this.#blobs = new Set();
+    this.#statementCache = new Map();
+    this.#statementCacheSize = options.statementCacheSize ?? 0;
+    this.#statementCacheHits = 0;
+    this.#statementCacheMisses = 0;
     this.#functionNames = new Map();
     this.#transactionDepth = 0;
 
@@ -201,6 +372,8 @@ export class DB {
       flags |= OpenFlags.Uri;
     }
 
+    this.#wasm.set_io_timing(options.ioTiming === true ? 1 : 0);
+
     // Try to open the database
     const status = setStr(
       this.#wasm,
@@ -255,14 +428,11 @@ export class DB {
     sql: string,
     params?: QueryParameterSet,
   ): Array<R> {
-    const query = this.prepareQuery<R>(sql);
+    const query = this.#takeCachedQuery<R>(sql);
     try {
-      const rows = query.all(params);
-      query.finalize();
-      return rows;
-    } catch (err) {
-      query.finalize();
-      throw err;
+      return query.all(params);
+    } finally {
+      this.#returnCachedQuery(sql, query);
     }
   }
 
@@ -289,14 +459,60 @@ export class DB {
     sql: string,
     params?: QueryParameterSet,
   ): Array<O> {
-    const query = this.prepareQuery<Row, O>(sql);
+    const query = this.#takeCachedQuery<Row, O>(sql);
     try {
-      const rows = query.allEntries(params);
-      query.finalize();
-      return rows;
-    } catch (err) {
+      return query.allEntries(params);
+    } finally {
+      this.#returnCachedQuery(sql, query);
+    }
+  }
+
+  /**
+   * Like `query` except the rows are returned in
+   * binary form, see `PreparedQuery.allPacked`.
+   */
+  queryPacked(sql: string, params?: QueryParameterSet): PackedRows {
+    const query = this.#takeCachedQuery(sql);
+    try {
+      return query.allPacked(params);
+    } finally {
+      this.#returnCachedQuery(sql, query);
+    }
+  }
+
+  #takeCachedQuery<R extends Row, O extends RowObject = RowObject>(
+    sql: string,
+  ): PreparedQuery<R, O> {
+    // Cached queries are removed while in use, so nested calls
+    // with the same SQL (e.g. from a user-defined function) get
+    // their own statement.
+    const query = this.#statementCache.get(sql);
+    if (query !== undefined) {
+      this.#statementCache.delete(sql);
+      this.#statementCacheHits += 1;
+      return query as PreparedQuery<R, O>;
+    }
+    if (this.#statementCacheSize > 0) {
+      this.#statementCacheMisses += 1;
+    }
+    return this.prepareQuery<R, O>(sql);
+  }
+
+  #returnCachedQuery(sql: string, query: PreparedQuery) {
+    if (
+      !this.#open || this.#statementCacheSize <= 0 ||
+      this.#statementCache.has(sql)
+    ) {
       query.finalize();
-      throw err;
+      return;
+    }
+    // Map iterates in insertion order, so the first entry
+    // is the least recently used one.
+    this.#statementCache.set(sql, query);
+    if (this.#statementCache.size > this.#statementCacheSize) {
+      const [lruSql, lruQuery] = this.#statementCache.entries().next().value!;
+      this.#statementCache.delete(lruSql);
+      lruQuery.finalize();
     }
   }
 
@@ -370,6 +586,153 @@ export class DB {
     return new PreparedQuery<R, O, P>(this.#wasm, stmt, this.#statements);
   }
 
+  /**
+   * Open a BLOB value for incremental I/O. This allows
+   * reading and writing large values in chunks, without
+   * holding the whole value in memory.
+   *
+   * The returned `SqliteBlob` must be closed by calling
+   * its `close` method once it is no longer needed.
+   *
+   * # Examples
+   *
+   * Copy a stored file to disk.
+   *
+   * ```typescript
+   * const blob = db.openBlob({ table: "files", column: "data", row: id });
+   * const file = await Deno.create("file.bin");
+   * await blob.readable.pipeTo(file.writable);
+   * blob.close();
+   * ```
+   *
+   * Fill a zero-filled blob of a given size.
+   *
+   * ```typescript
+   * db.query("INSERT INTO files (data) VALUES (zeroblob(?))", [size]);
+   * const blob = db.openBlob({
+   *   table: "files",
+   *   column: "data",
+   *   row: db.lastInsertRowId,
+   *   mode: "write",
+   * });
+   * blob.writeSync(header);
+   * blob.close();
+   * ```
+   */
+  openBlob(options: SqliteBlobOptions): SqliteBlob {
+    if (!this.#open) {
+      throw new SqliteError("Database was closed.");
+    }
+
+    const writable = options.mode === "write";
+    const blob = setStr(
+      this.#wasm,
+      options.schema ?? "main",
+      (schema) =>
+        setStr(
+          this.#wasm,
+          options.table,
+          (table) =>
+            setStr(
+              this.#wasm,
+              options.column,
+              (column) =>
+                this.#wasm.blob_open(
+                  schema,
+                  table,
+                  column,
+                  options.row,
+                  writable ? 1 : 0,
+                ),
+            ),
+        ),
+    );
+    if (blob === Values.Null) {
+      throw new SqliteError(this.#wasm);
+    }
+
+    this.#blobs.add(blob);
+    return new SqliteBlob(this.#wasm, blob, this.#blobs, writable);
+  }
+
+  /**
+   * Return performance statistics for the database.
+   * This includes counters for file I/O, the page
+   * cache, and the statement cache, as well as the
+   * memory used by SQLite.
+   *
+   * If `reset` is `true`, all counters and high-water
+   * marks are reset after they were read, so that the
+   * next call only reports what happened in between.
+   *
+   * See `PreparedQuery.stats` for statistics of
+   * individual queries.
+   *
+   * # Example
+   *
+   * ```typescript
+   * const { io, pageCache } = db.stats(true);
+   * console.log(io.jsTime, pageCache.misses);
+   * ```
+   */
+  stats(reset = false): DatabaseStats {
+    if (!this.#open) {
+      throw new SqliteError("Database was closed.");
+    }
+
+    const ptr = this.#wasm.db_stats(reset ? 1 : 0);
+    const values = new Float64Array(
+      this.#wasm.memory.buffer,
+      ptr,
+      DB_STATS_COUNT,
+    );
+    const stats: DatabaseStats = {
+      io: {
+        reads: values[0],
+        writes: values[1],
+        syncs: values[2],
+        bytesRead: values[3],
+        bytesWritten: values[4],
+        jsCalls: values[5],
+        jsReads: values[6],
+        jsWrites: values[7],
+        jsTime: values[8],
+      },
+      pageCache: {
+        used: values[17],
+        hits: values[19],
+        misses: values[21],
+        writes: values[23],
+        spills: values[25],
+      },
+      lookaside: {
+        used: values[27],
+        highwater: values[28],
+        hits: values[30],
+        missesSize: values[32],
+        missesFull: values[34],
+      },
+      memory: {
+        used: values[9],
+        highwater: values[10],
+        allocations: values[11],
+        allocationsHighwater: values[12],
+        largestAllocation: values[14],
+        pageCache: values[15],
+        pageCacheHighwater: values[16],
+        schema: values[35],
+        statements: values[37],
+      },
+      statementCache: this.statementCacheStats,
+    };
+
+    if (reset) {
+      this.#statementCacheHits = 0;
+      this.#statementCacheMisses = 0;
+    }
+    return stats;
+  }
+
   /**
    * Run multiple semicolon-separated statements from a single
    * string.
@@ -601,13 +964,126 @@ export class DB {
     R extends SqlFunctionResult = SqlFunctionResult,
   >(func: (...args: A) => R, options?: SqliteFunctionOptions) {
     const name = options?.name ?? func.name;
+    const argc = func.length === 0 ? -1 : func.length;
+    this.#addFunction(
+      name,
+      argc,
+      options,
+      "scalar",
+      wrapSqlFunction(
+        this.#wasm,
+        name,
+        /* This cast is not fully correct (because function arguments
+         * are contra-variant), but makes defining custom functions
+         * slightly nicer. */
+        func as unknown as SqlFunction,
+      ),
+    );
+  }
+
+  /**
+   * Creates a custom SQL aggregate function that can
+   * be used in queries. Unlike scalar functions, an
+   * aggregate has no name of its own, so the `name`
+   * option must be given.
+   *
+   * See `SqlAggregate` for how aggregates are computed.
+   * The number of arguments is inferred from `step`,
+   * which takes the state as its first argument.
+   *
+   * # Examples
+   *
+   * ```typescript
+   * db.createAggregate({
+   *   start: 1,
+   *   step: (product: number, value: number) => product * value,
+   * }, { name: "product" });
+   * db.query("SELECT product(price) FROM products");
+   * ```
+   *
+   * A fresh state can be created for every use of
+   * the aggregate by passing a function as `start`.
+   *
+   * ```typescript
+   * db.createAggregate({
+   *   start: () => [] as string[],
+   *   step: (names: string[], name: string) => [...names, name],
+   *   final: (names: string[]) => names.sort().join(", "),
+   * }, { name: "sorted_names" });
+   * db.query("SELECT city, sorted_names(name) FROM people GROUP BY city");
+   * ```
+   */
+  createAggregate<
+    S,
+    A extends Array<SqlFunctionArgument> = Array<SqlFunctionArgument>,
+    R extends SqlFunctionResult = SqlFunctionResult,
+  >(aggregate: SqlAggregate<S, A, R>, options: SqliteFunctionOptions) {
+    const name = options.name ?? "";
+    this.#addFunction(
+      name,
+      aggregate.step.length <= 1 ? -1 : aggregate.step.length - 1,
+      options,
+      "aggregate",
+      wrapSqlAggregate(
+        this.#wasm,
+        name,
+        aggregate as unknown as SqlAggregate<unknown>,
+      ),
+    );
+  }
+
+  /**
+   * Creates a custom SQL aggregate function, which can
+   * also be used as a window function. Like `createAggregate`
+   * this requires the `name` option.
+   *
+   * See `SqlWindowFunction` for how the function is computed.
+   *
+   * # Examples
+   *
+   * ```typescript
+   * db.createWindowFunction({
+   *   start: 0,
+   *   step: (sum: number, value: number) => sum + value,
+   *   inverse: (sum: number, value: number) => sum - value,
+   * }, { name: "js_sum" });
+   * db.query(
+   *   "SELECT js_sum(value) OVER (ORDER BY id ROWS 2 PRECEDING) FROM measurements",
+   * );
+   * ```
+   */
+  createWindowFunction<
+    S,
+    A extends Array<SqlFunctionArgument> = Array<SqlFunctionArgument>,
+    R extends SqlFunctionResult = SqlFunctionResult,
+  >(func: SqlWindowFunction<S, A, R>, options: SqliteFunctionOptions) {
+    const name = options.name ?? "";
+    this.#addFunction(
+      name,
+      func.step.length <= 1 ? -1 : func.step.length - 1,
+      options,
+      "window",
+      wrapSqlAggregate(
+        this.#wasm,
+        name,
+        func as unknown as SqlWindowFunction<unknown>,
+      ),
+    );
+  }
+
+  #addFunction(
+    name: string,
+    argc: number,
+    options: SqliteFunctionOptions | undefined,
+    type: "scalar" | "aggregate" | "window",
+    func: UserFunction,
+  ) {
     if (name === "") {
       throw new SqliteError("Function name can not be empty");
     } else if (this.#functionNames.has(name)) {
       throw new SqliteError(`A function named '${name}' already exists`);
     }
 
-    const argc = func.length === 0 ? -1 : func.length;
     let flags = 0;
     if (options?.deterministic ?? false) flags |= FunctionFlags.Deterministic;
     if (options?.directOnly ?? true) flags |= FunctionFlags.DirectOnly;
@@ -616,27 +1092,30 @@ export class DB {
     const status = setStr(
       this.#wasm,
       name,
-      (name) => this.#wasm.create_function(name, argc, flags, funcIdx),
+      (name) =>
+        type === "scalar"
+          ? this.#wasm.create_function(name, argc, flags, funcIdx)
+          : this.#wasm.create_aggregate(
+            name,
+            argc,
+            flags,
+            funcIdx,
+            type === "window" ? 1 : 0,
+          ),
     );
 
     if (status !== Status.SqliteOk) {
       throw new SqliteError(this.#wasm, status);
     } else {
-      this.#functions[funcIdx] = wrapSqlFunction(
-        this.#wasm,
-        name,
-        /* This cast is not fully correct (because function arguments
-         * are contra-variant), but makes defining custom functions
-         * slightly nicer. */
-        func as unknown as SqlFunction,
-      );
-      this.#functionNames.set(name, funcIdx);
+      this.#functions[funcIdx] = func;
+      this.#functionNames.set(name, { funcIdx, argc });
     }
   }
 
   /**
    * Delete a user-defined SQL function previously
-   * created with `createFunction`.
+   * created with `createFunction`, `createAggregate`,
+   * or `createWindowFunction`.
    *
    * After the function is deleted, it can no longer be
    * used in queries, and is free to be re-defined.
@@ -652,13 +1131,13 @@ export class DB {
    */
   deleteFunction(name: string) {
     if (this.#functionNames.has(name)) {
+      const { funcIdx, argc } = this.#functionNames.get(name)!;
       const status = setStr(
         this.#wasm,
         name,
-        (pts) => this.#wasm.delete_function(pts),
+        (pts) => this.#wasm.delete_function(pts, argc),
       );
       if (status === Status.SqliteOk) {
-        const funcIdx = this.#functionNames.get(name)!;
         this.#functionNames.delete(name);
         delete this.#functions[funcIdx];
       } else {
@@ -675,8 +1154,11 @@ export class DB {
    * open file descriptors.
    *
    * If called with `force = true`, any non-finalized
-   * `PreparedQuery` objects will be finalized. Otherwise,
-   * this throws if there are active queries.
+   * `PreparedQuery` objects will be finalized, and any
+   * open `SqliteBlob` handles will be closed. Otherwise,
+   * this throws if there are active queries or blobs.
+   * Statements held by the statement cache are always
+   * finalized.
    *
    * `close` may safely be called multiple
    * times.
@@ -685,12 +1167,20 @@ export class DB {
     if (!this.#open) {
       return;
     }
+    for (const query of this.#statementCache.values()) {
+      query.finalize();
+    }
+    this.#statementCache.clear();
     if (force) {
       for (const stmt of this.#statements) {
         if (this.#wasm.finalize(stmt) !== Status.SqliteOk) {
           throw new SqliteError(this.#wasm);
         }
       }
+      for (const blob of this.#blobs) {
+        this.#wasm.blob_close(blob);
+      }
+      this.#blobs.clear();
     }
     if (this.#wasm.close() !== Status.SqliteOk) {
       throw new SqliteError(this.#wasm);
@@ -738,6 +1228,19 @@ export class DB {
     return this.#wasm.autocommit() !== 0;
   }
 
+  /**
+   * Returns hit and miss counts for the statement
+   * cache, see `SqliteOptions.statementCacheSize`.
+   */
+  get statementCacheStats(): StatementCacheStats {
+    return {
+      hits: this.#statementCacheHits,
+      misses: this.#statementCacheMisses,
+      size: this.#statementCache.size,
+      capacity: this.#statementCacheSize,
+    };
+  }
+
   /**
    * Returns `true` when the database handle is closed
    * and can no longer be used.
@@ -140,6 +140,16 @@ Deno.test("accept and return string values", function () {
   assertEquals(values, roundTripValues(values));
 });
 
+Deno.test("string arguments keep a leading BOM", function () {
+  const db = new DB();
+  db.createFunction((a: string, b: string) => `${a.length} ${b}`, {
+    name: "describe",
+  });
+  const params = ["\uFEFFab", "cd"];
+  assertEquals(db.query("SELECT describe(?, ?)", params), [["3 cd"]]);
+  db.close();
+});
+
 Deno.test("accept and return integer values", function () {
   const values = [0, 42, 1, 2, 3, 4, 3453246, 4536787093, 45536787093];
   assertEquals(values, roundTripValues(values));
@@ -201,3 +211,112 @@ Deno.test("return date returns formatted string", function () {
     "2022-11-03T10:37:19.931Z",
   ]], db.query("SELECT unix(0), unix(42), unix(1667471839931)"));
 });
+
+Deno.test("can create aggregate functions", function () {
+  const db = new DB();
+  db.query("CREATE TABLE test (grp TEXT, value INTEGER)");
+  db.query(
+    "INSERT INTO test (grp, value) VALUES ('a', 2), ('a', 3), ('b', 7)",
+  );
+  db.createAggregate({
+    start: 1,
+    step: (product: number, value: number) => product * value,
+  }, { name: "product" });
+  assertEquals(
+    db.query("SELECT grp, product(value) FROM test GROUP BY grp"),
+    [["a", 6], ["b", 7]],
+  );
+  // an aggregate over no rows returns the start state
+  assertEquals(db.query("SELECT product(value) FROM test WHERE 0"), [[1]]);
+});
+
+Deno.test("aggregate functions get a fresh state for every group", function () {
+  const db = new DB();
+  db.query("CREATE TABLE test (grp INTEGER, name TEXT)");
+  db.query(
+    "INSERT INTO test (grp, name) VALUES (1, 'b'), (2, 'c'), (1, 'a')",
+  );
+  db.createAggregate({
+    start: () => [] as Array<string>,
+    step: (names: Array<string>, name: string) => {
+      names.push(name);
+      return names;
+    },
+    final: (names: Array<string>) => names.sort().join(","),
+  }, { name: "names" });
+  assertEquals(
+    db.query("SELECT grp, names(name) FROM test GROUP BY grp ORDER BY grp"),
+    [[1, "a,b"], [2, "c"]],
+  );
+});
+
+Deno.test("can create window functions", function () {
+  const db = new DB();
+  db.query("CREATE TABLE test (id INTEGER PRIMARY KEY, value INTEGER)");
+  db.query("INSERT INTO test (value) VALUES (1), (2), (4), (8), (16)");
+  db.createWindowFunction({
+    start: 0,
+    step: (sum: number, value: number) => sum + value,
+    inverse: (sum: number, value: number) => sum - value,
+  }, { name: "js_sum" });
+  const frame = "OVER (ORDER BY id ROWS BETWEEN 1 PRECEDING AND CURRENT ROW)";
+  assertEquals(
+    db.query(`SELECT js_sum(value) ${frame} FROM test`),
+    db.query(`SELECT sum(value) ${frame} FROM test`),
+  );
+  // window functions are also aggregates
+  assertEquals(db.query("SELECT js_sum(value) FROM test"), [[31]]);
+});
+
+Deno.test("can throw errors in aggregate functions", function () {
+  const db = new DB();
+  db.query("CREATE TABLE test (value INTEGER)");
+  db.query("INSERT INTO test (value) VALUES (1), (2)");
+  db.createAggregate({
+    start: 0,
+    step: (_count: number, value: number) => {
+      throw new Error(`Boom ${value}!`);
+    },
+  }, { name: "explode" });
+  assertThrows(
+    () => db.query("SELECT explode(value) FROM test"),
+    (err: Error) => {
+      assertInstanceOf(err, SqliteError);
+      assertEquals(err.code, Status.SqliteError);
+      assertEquals(
+        err.message,
+        "Error in user defined function 'explode': Boom 1!",
+      );
+    },
+  );
+});
+
+Deno.test("can delete aggregate functions", function () {
+  const db = new DB();
+  const count = { start: 0, step: (count: number) => count + 1 };
+  // aggregates have no name to infer
+  assertThrows(() => db.createAggregate(count, {}));
+  db.createAggregate(count, { name: "js_count" });
+  assertEquals(db.query("SELECT js_count() FROM (SELECT 1 UNION SELECT 2)"), [
+    [2],
+  ]);
+  db.deleteFunction("js_count");
+  assertThrows(() => db.query("SELECT js_count()"));
+  db.createAggregate(count, { name: "js_count" });
+  assertEquals(db.query("SELECT js_count()"), [[1]]);
+});
+
+Deno.test("functions can run queries while rows are returned", function () {
+  const db = new DB();
+  db.query("CREATE TABLE test (id INTEGER PRIMARY KEY, name TEXT)");
+  db.query("INSERT INTO test (name) VALUES ('a'), ('b'), ('c'), ('d')");
+  // the inner query returns different values than the outer one
+  const countBelow = (id: number) =>
+    db.query("SELECT id * 1000, name || 'x' FROM test WHERE id < ?", [id])
+      .length;
+  db.createFunction(countBelow, { name: "count_below" });
+  assertEquals(
+    db.query("SELECT id, count_below(id), name FROM test ORDER BY id"),
+    [[1, 0, "a"], [2, 1, "b"], [3, 2, "c"], [4, 3, "d"]],
+  );
+});
@@ -1,6 +1,6 @@
 import { Wasm } from "../build/sqlite.js";
-import { Status, Types } from "./constants.ts";
-import { getStr, setArr, setStr } from "./wasm.ts";
+import { FunctionCalls, Status } from "./constants.ts";
+import { getRows, setArr, setStr } from "./wasm.ts";
 import { SqliteError } from "./error.ts";
 
 /**
@@ -47,104 +47,179 @@ export type SqlFunction = (
   ...args: Array<SqlFunctionArgument>
 ) => SqlFunctionResult;
 
+/**
+ * A user-defined SQL aggregate function, see
+ * `DB.createAggregate`.
+ *
+ * The aggregate starts out with the `start` state,
+ * which is passed to `step` together with the arguments
+ * of each row. `step` returns the new state, and once
+ * all rows were stepped through, `final` computes the
+ * result from the last state. If `final` is omitted,
+ * the last state is returned as the result.
+ *
+ * If `start` is a function, it is called to create
+ * a fresh state for each use of the aggregate.
+ */
+export interface SqlAggregate<
+  S,
+  A extends Array<SqlFunctionArgument> = Array<SqlFunctionArgument>,
+  R extends SqlFunctionResult = SqlFunctionResult,
+> {
+  start: S | (() => S);
+  step: (state: S, ...args: A) => S;
+  final?: (state: S) => R;
+}
+
+/**
+ * A user-defined SQL aggregate window function, see
+ * `DB.createWindowFunction`.
+ *
+ * In addition to an aggregate, a window function
+ * removes rows which leave the window by passing them
+ * to `inverse`, which returns the new state. `value`
+ * computes the result for the current window without
+ * finishing the aggregate. If `value` is omitted,
+ * `final` is used instead.
+ */
+export interface SqlWindowFunction<
+  S,
+  A extends Array<SqlFunctionArgument> = Array<SqlFunctionArgument>,
+  R extends SqlFunctionResult = SqlFunctionResult,
+> extends SqlAggregate<S, A, R> {
+  inverse: (state: S, ...args: A) => S;
+  value?: (state: S) => R;
+}
+
+/**
+ * Implementation of a user-defined function, called from
+ * `js_call_user_func` with the kind of call (see `FunctionCalls`),
+ * the id of the aggregate state, and the packed arguments.
+ */
+export type UserFunction = (
+  call: FunctionCalls,
+  state: number,
+  argc: number,
+  args: number,
+) => void;
+
 export function wrapSqlFunction(
   wasm: Wasm,
   name: string,
   func: SqlFunction,
-): (argc: number) => void {
-  return (argCount: number) => {
-    // This logic is similar to how we read rows in `query.ts`
-    const args: Array<SqlFunctionArgument> = new Array(argCount);
-    for (let argIdx = 0; argIdx < argCount; argIdx++) {
-      switch (wasm.argument_type(argIdx)) {
-        case Types.Integer:
-          args[argIdx] = wasm.argument_int(argIdx);
-          break;
-        case Types.Float:
-          args[argIdx] = wasm.argument_double(argIdx);
-          break;
-        case Types.Text:
-          args[argIdx] = getStr(wasm, wasm.argument_text(argIdx));
-          break;
-        case Types.Blob: {
-          const ptr = wasm.argument_blob(argIdx);
-          if (ptr === 0) {
-            // Zero pointer results in null
-            args[argIdx] = null;
-          } else {
-            const length = wasm.argument_bytes(argIdx);
-            // Slice should copy the bytes, as it makes a shallow copy
-            args[argIdx] = new Uint8Array(wasm.memory.buffer, ptr, length)
-              .slice();
-          }
-          break;
-        }
-        case Types.BigInteger: {
-          const ptr = wasm.argument_text(argIdx);
-          args[argIdx] = BigInt(getStr(wasm, ptr));
-          break;
-        }
-        default:
-          args[argIdx] = null;
-          break;
-      }
+): UserFunction {
+  return (_call, _state, argc, args) => {
+    try {
+      const values = getRows(wasm.memory.buffer, args, 1, argc)[0];
+      setResult(wasm, func.apply(null, values as Array<SqlFunctionArgument>));
+    } catch (error) {
+      setError(wasm, name, error);
     }
+  };
+}
+
+export function wrapSqlAggregate(
+  wasm: Wasm,
+  name: string,
+  aggregate: SqlAggregate<unknown> | SqlWindowFunction<unknown>,
+): UserFunction {
+  // State of each running aggregate, by the id assigned in C
+  const states = new Map<number, unknown>();
+  const getState = (state: number) => {
+    if (states.has(state)) return states.get(state);
+    const start = aggregate.start;
+    return typeof start === "function" ? start() : start;
+  };
+  const final = aggregate.final ?? ((state: unknown) => state);
+  const value = "value" in aggregate && aggregate.value
+    ? aggregate.value
+    : final;
 
+  return (call, state, argc, args) => {
     try {
-      let result = func.apply(null, args);
-      // This logic is similar to how we bind query parameters in `query.ts`
-      switch (typeof result) {
-        case "boolean":
-          result = result ? 1 : 0;
-          // fall through
-        case "number":
-          if (Number.isSafeInteger(result)) {
-            wasm.result_int(result);
-          } else {
-            wasm.result_double(result);
-          }
+      switch (call) {
+        case FunctionCalls.Step:
+        case FunctionCalls.Inverse: {
+          const values = getRows(wasm.memory.buffer, args, 1, argc)[0];
+          const reduce = call === FunctionCalls.Step
+            ? aggregate.step
+            : (aggregate as SqlWindowFunction<unknown>).inverse;
+          states.set(
+            state,
+            reduce(getState(state), ...values as Array<SqlFunctionArgument>),
+          );
           break;
-        case "bigint":
-          // bigint is bound as two 32bit integers and reassembled on the C side
-          if (result > 9223372036854775807n || result < -9223372036854775808n) {
-            throw new SqliteError(
-              `BigInt result ${result} overflows 64 bit integer.`,
-            );
-          } else {
-            const posVal = result >= 0n ? result : -result;
-            const sign = result >= 0n ? 1 : -1;
-            const upper = Number(BigInt.asUintN(32, posVal >> 32n));
-            const lower = Number(BigInt.asUintN(32, posVal));
-            wasm.result_big_int(sign, upper, lower);
-          }
-          break;
-        case "string":
-          setStr(wasm, result, (ptr) => wasm.result_text(ptr));
+        }
+        case FunctionCalls.Value:
+          setResult(wasm, value(getState(state)) as SqlFunctionResult);
           break;
-        default:
-          if (result instanceof Date) {
-            // Dates are allowed and bound to TEXT, formatted `YYYY-MM-DDTHH:MM:SS.SSSZ`
-            setStr(wasm, result.toISOString(), (ptr) => wasm.result_text(ptr));
-          } else if (result instanceof Uint8Array) {
-            // Uint8Arrays are allowed and bound to BLOB
-            const size = result.length;
-            setArr(wasm, result, (ptr) => wasm.result_blob(ptr, size));
-          } else if (result === null || result === undefined) {
-            // Both null and undefined result in a NULL entry
-            wasm.result_null();
-          } else {
-            throw new SqliteError(`Can not return ${typeof result}.`);
-          }
+        case FunctionCalls.Final: {
+          const last = getState(state);
+          states.delete(state);
+          setResult(wasm, final(last) as SqlFunctionResult);
           break;
+        }
       }
     } catch (error) {
-      setStr(
-        wasm,
-        `Error in user defined function '${name}': ${
-          (error as Error)?.message
-        }`,
-        (ptr) => wasm.result_error(ptr, Status.SqliteError),
-      );
+      setError(wasm, name, error);
     }
   };
 }
+
+// Return the result of a user-defined function to C
+function setResult(wasm: Wasm, result: SqlFunctionResult) {
+  // This logic is similar to how we bind query parameters in `query.ts`
+  switch (typeof result) {
+    case "boolean":
+      result = result ? 1 : 0;
+      // fall through
+    case "number":
+      if (Number.isSafeInteger(result)) {
+        wasm.result_int(result);
+      } else {
+        wasm.result_double(result);
+      }
+      break;
+    case "bigint":
+      // bigint is bound as two 32bit integers and reassembled on the C side
+      if (result > 9223372036854775807n || result < -9223372036854775808n) {
+        throw new SqliteError(
+          `BigInt result ${result} overflows 64 bit integer.`,
+        );
+      } else {
+        const posVal = result >= 0n ? result : -result;
+        const sign = result >= 0n ? 1 : -1;
+        const upper = Number(BigInt.asUintN(32, posVal >> 32n));
+        const lower = Number(BigInt.asUintN(32, posVal));
+        wasm.result_big_int(sign, upper, lower);
+      }
+      break;
+    case "string":
+      setStr(wasm, result, (ptr) => wasm.result_text(ptr));
+      break;
+    default:
+      if (result instanceof Date) {
+        // Dates are allowed and bound to TEXT, formatted `YYYY-MM-DDTHH:MM:SS.SSSZ`
+        setStr(wasm, result.toISOString(), (ptr) => wasm.result_text(ptr));
+      } else if (result instanceof Uint8Array) {
+        // Uint8Arrays are allowed and bound to BLOB
+        const size = result.length;
+        setArr(wasm, result, (ptr) => wasm.result_blob(ptr, size));
+      } else if (result === null || result === undefined) {
+        // Both null and undefined result in a NULL entry
+        wasm.result_null();
+      } else {
+        throw new SqliteError(`Can not return ${typeof result}.`);
+      }
+      break;
+  }
+}
+
+// Report an error thrown by a user-defined function to C
+function setError(wasm: Wasm, name: string, error: unknown) {
+  setStr(
+    wasm,
+    `Error in user defined function '${name}': ${(error as Error)?.message}`,
+    (ptr) => wasm.result_error(ptr, Status.SqliteError),
+  );
+}
@@ -1,9 +1,16 @@
 import {
+  assert,
   assertEquals,
   assertThrows,
 } from "https://deno.land/std@0.154.0/testing/asserts.ts";
 
-import { DB, QueryParameter } from "../mod.ts";
+import {
+  DB,
+  QueryParameter,
+  SqliteError,
+  Status,
+  unpackRows,
+} from "../mod.ts";
 
 function roundTripValues<T extends QueryParameter>(values: T[]): unknown[] {
   const db = new DB();
@@ -266,6 +273,101 @@ Deno.test("iterate from prepared query", function () {
   db.close();
 });
 
+Deno.test("fetch rows spanning multiple batches", function () {
+  const db = new DB();
+  db.execute(
+    "CREATE TABLE test (id INTEGER PRIMARY KEY, name TEXT, data ANY)",
+  );
+  const insert = db.prepareQuery(
+    "INSERT INTO test (name, data) VALUES (?, ?)",
+  );
+  const expected = [];
+  for (let i = 1; i <= 3000; i++) {
+    const name = i % 3 === 0 ? `Ünïcödé 👋 ${i}` : `name ${i}`;
+    const data = [
+      i,
+      i / 7,
+      BigInt(Number.MAX_SAFE_INTEGER) + BigInt(i),
+      new Uint8Array([i % 256, 0, 1]),
+      null,
+    ][i % 5];
+    insert.execute([name, data]);
+    expected.push([i, name, data]);
+  }
+  insert.finalize();
+
+  const query = db.prepareQuery("SELECT id, name, data FROM test");
+  assertEquals(query.all(), expected);
+  assertEquals([...query.iter()], expected);
+  assertEquals(query.first(), expected[0]);
+  query.finalize();
+  db.close();
+});
+
+Deno.test("execute many parameter sets", function () {
+  const db = new DB();
+  db.execute(
+    "CREATE TABLE test (id INTEGER PRIMARY KEY, name TEXT UNIQUE, data ANY)",
+  );
+
+  const insert = db.prepareQuery(
+    "INSERT INTO test (id, name, data) VALUES (:id, :name, :data)",
+  );
+  const rows = [
+    { id: 1, name: "Peter Parker", data: 4.2 },
+    { id: 2, name: "Tüst 👋", data: 9223372036854775807n },
+    { id: 3, name: "", data: new Uint8Array([1, 2, 3]) },
+    { id: 4, name: "Clark Kent", data: new Date(0) },
+    { id: 5, name: "Bruce Wayne", data: null },
+  ];
+  insert.executeMany(rows);
+  assertEquals(
+    db.query("SELECT id, name, data FROM test"),
+    rows.map(({ id, name, data }) => [
+      id,
+      name,
+      data instanceof Date ? data.toISOString() : data,
+    ]),
+  );
+
+  // Stops at the first failing parameter set
+  const error = assertThrows(
+    () =>
+      insert.executeMany([
+        { id: 6, name: "Diana Prince", data: null },
+        { id: 7, name: "Peter Parker", data: null },
+        { id: 8, name: "Barry Allen", data: null },
+      ]),
+    SqliteError,
+  );
+  assertEquals(error.code, Status.SqliteConstraint);
+  assertEquals(db.query("SELECT id FROM test WHERE id > 5"), [[6]]);
+
+  insert.finalize();
+  db.close();
+});
+
+Deno.test("execute many does not reuse earlier parameters", function () {
+  const db = new DB();
+  db.execute("CREATE TABLE test (a, b)");
+
+  const positional = db.prepareQuery("INSERT INTO test (a, b) VALUES (?, ?)");
+  positional.executeMany([[1, 2], [3]]);
+  positional.finalize();
+
+  const named = db.prepareQuery("INSERT INTO test (a, b) VALUES (:a, :b)");
+  named.executeMany([{ a: 4, b: 5 }, { a: 6 }]);
+  named.finalize();
+
+  assertEquals(db.query("SELECT a, b FROM test"), [
+    [1, 2],
+    [3, null],
+    [4, 5],
+    [6, null],
+  ]);
+  db.close();
+});
+
 Deno.test("query all from prepared query", function () {
   const db = new DB();
   db.query("CREATE TABLE test (id INTEGER PRIMARY KEY AUTOINCREMENT)");
@@ -520,6 +622,35 @@ Deno.test("get columns from finalized query throws", function () {
   });
 });
 
+Deno.test("query stats count full scans and sorts", function () {
+  const db = new DB();
+  db.query("CREATE TABLE test (id INTEGER PRIMARY KEY, value INTEGER)");
+  const insert = db.prepareQuery("INSERT INTO test (value) VALUES (?)");
+  insert.executeMany([1, 2, 3, 4, 5, 6, 7, 8].map((value) => [value]));
+  insert.finalize();
+
+  const scan = db.prepareQuery(
+    "SELECT id FROM test WHERE value > ? ORDER BY value DESC",
+  );
+  assertEquals(scan.all([6]), [[8], [7]]);
+  const stats = scan.stats(true);
+  assert(stats.fullScanSteps > 0);
+  assert(stats.vmSteps > 0);
+  assertEquals(stats.sorts, 1);
+  assertEquals(stats.autoIndexes, 0);
+  assertEquals(stats.runs, 1);
+  assertEquals(scan.stats().fullScanSteps, 0);
+  scan.finalize();
+  assertThrows(() => scan.stats());
+
+  const lookup = db.prepareQuery("SELECT value FROM test WHERE id = ?");
+  assertEquals(lookup.all([3]), [[3]]);
+  assertEquals(lookup.stats().fullScanSteps, 0);
+  lookup.finalize();
+
+  db.close();
+});
+
 Deno.test("introspect SQL for prepared queries", function () {
   const db = new DB();
   db.query(
@@ -549,3 +680,45 @@ Deno.test("introspect SQL for prepared queries", function () {
   query.finalize();
   db.close();
 });
+
+Deno.test("invalid UTF-8 text does not bleed into other columns", function () {
+  const db = new DB();
+  // counting UTF-16 units without validating the bytes
+  // gives the decoded length of these rows by accident
+  assertEquals(
+    db.query(
+      "SELECT CAST(x'f061' AS TEXT), CAST(x'80' AS TEXT), 'ok' UNION ALL " +
+        "SELECT CAST(x'e0' AS TEXT), CAST(x'a080' AS TEXT), 'é'",
+    ),
+    [["\uFFFDa", "\uFFFD", "ok"], ["\uFFFD", "\uFFFD\uFFFD", "é"]],
+  );
+  db.close();
+});
+
+Deno.test("leading BOM is kept when text is decoded", function () {
+  const db = new DB();
+  const row = ["\uFEFFab", "cd"];
+  assertEquals(db.query("SELECT ?, ?", row), [row]);
+  db.close();
+});
+
+Deno.test("packed rows round-trip", function () {
+  const db = new DB();
+  const query = db.prepareQuery(
+    "SELECT ? AS a, ? AS b, ? AS c, ? AS d, ? AS e, ? AS f",
+  );
+  const params = [
+    1,
+    2.5,
+    "Wéll, hällö",
+    new Uint8Array([1, 2]),
+    null,
+    2n ** 60n,
+  ];
+  const packed = query.allPacked(params);
+  assertEquals(packed.columns, ["a", "b", "c", "d", "e", "f"]);
+  assertEquals(unpackRows(packed), [params]);
+  assertEquals(unpackRows(db.queryPacked("SELECT 1 WHERE 0")), []);
+  query.finalize();
+  db.close();
+});
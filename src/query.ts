@@ -1,8 +1,19 @@
 import { StatementPtr, Wasm } from "../build/sqlite.js";
-import { getStr, setArr, setStr } from "./wasm.ts";
+import { copyRows, getRows, getStr, setStr } from "./wasm.ts";
 import { Status, Types, Values } from "./constants.ts";
 import { SqliteError } from "./error.ts";
 
+// Maximum number of rows fetched from `step_rows` at once. The
+// C side additionally limits the size of each batch in bytes.
+const ITER_BATCH_ROWS = 64;
+const ALL_BATCH_ROWS = 1024;
+
+// Parameter sets passed to `executeMany` are sent to
+// `execute_batch` in chunks of roughly this many bytes.
+const EXECUTE_BATCH_BYTES = 1 << 20;
+
+const textEncoder = new TextEncoder();
+
 /**
  * The default type for returned rows.
  */
@@ -118,6 +129,69 @@ export interface ColumnName {
   tableName: string;
 }
 
+/**
+ * Performance statistics of a prepared query,
+ * see `PreparedQuery.stats`.
+ *
+ * These correspond to the counters returned by
+ * the `sqlite3_stmt_status` function.
+ */
+export interface QueryStats {
+  /**
+   * Number of steps taken in full table scans.
+   * A large number may indicate a missing index.
+   */
+  fullScanSteps: number;
+  /** Number of sort operations. */
+  sorts: number;
+  /**
+   * Number of rows inserted into automatic
+   * indices, which SQLite creates if no fitting
+   * index exists.
+   */
+  autoIndexes: number;
+  /** Number of virtual machine operations. */
+  vmSteps: number;
+  /**
+   * Number of times the query was prepared again,
+   * e.g. because the schema changed.
+   */
+  reprepares: number;
+  /** Number of times the query was run. */
+  runs: number;
+  /** Bytes of memory used by the prepared query. */
+  memoryUsed: number;
+}
+
+// Number of values returned by the `stmt_stats` export, see `wrapper.c`
+const STMT_STATS_COUNT = 7;
+
+/**
+ * Rows in the binary format produced by SQLite,
+ * see `PreparedQuery.allPacked`. The buffers can
+ * be transferred to a different thread, and are
+ * decoded using `unpackRows`.
+ */
+export interface PackedRows {
+  /** Names of the columns of each row. */
+  columns: Array<string>;
+  /** Batches of rows, in order. */
+  batches: Array<{ rowCount: number; buffer: ArrayBuffer }>;
+}
+
+/**
+ * Decode rows returned by `PreparedQuery.allPacked`.
+ */
+export function unpackRows<R extends Row = Row>(packed: PackedRows): Array<R> {
+  const rows: Array<R> = [];
+  for (const { rowCount, buffer } of packed.batches) {
+    rows.push(
+      ...getRows(buffer, 0, rowCount, packed.columns.length) as Array<R>,
+    );
+  }
+  return rows;
+}
+
 interface RowsIterator<R> {
   next: () => IteratorResult<R>;
   [Symbol.iterator]: () => RowsIterator<R>;
@@ -137,8 +211,11 @@ export class PreparedQuery<
   #openStatements: Set<StatementPtr>;
 
   #status: number;
+  #rows: Array<R>;
+  #rowIdx: number;
   #iterKv: boolean;
   #rowKeys?: Array<string>;
+  #paramIndices: Map<string, number>;
   #finalized: boolean;
 
   /**
@@ -156,42 +233,60 @@ export class PreparedQuery<
     this.#openStatements = openStatements;
 
     this.#status = Status.Unknown;
+    this.#rows = [];
+    this.#rowIdx = 0;
     this.#iterKv = false;
+    this.#paramIndices = new Map();
     this.#finalized = false;
   }
 
+  #parameterArray(params?: P): Array<QueryParameter> {
+    if (Array.isArray(params)) {
+      return params;
+    }
+
+    const parameters: Array<QueryParameter> = [];
+    if (typeof params === "object") {
+      // Resolve parameter index for named parameter
+      for (const key of Object.keys(params)) {
+        let idx = this.#paramIndices.get(key);
+        if (idx === undefined) {
+          let name = key;
+          // blank names default to ':'
+          if (name[0] !== ":" && name[0] !== "@" && name[0] !== "$") {
+            name = `:${name}`;
+          }
+          idx = setStr(
+            this.#wasm,
+            name,
+            (ptr) => this.#wasm.bind_parameter_index(this.#stmt, ptr),
+          );
+          if (idx === Values.Error) {
+            throw new SqliteError(`No parameter named '${name}'.`);
+          }
+          this.#paramIndices.set(key, idx);
+        }
+        parameters[idx - 1] = params[key];
+      }
+    }
+    return parameters;
+  }
+
   #startQuery(params?: P) {
     if (this.#finalized) {
       throw new SqliteError("Query is finalized.");
     }
 
     // Reset query
+    this.#rows = [];
+    this.#rowIdx = 0;
+    // The schema may have changed since the last run (e.g.
+    // for `SELECT *`), so column names are looked up again
+    this.#rowKeys = undefined;
     this.#wasm.reset(this.#stmt);
     this.#wasm.clear_bindings(this.#stmt);
 
-    // Prepare parameter array
-    let parameters = [];
-    if (Array.isArray(params)) {
-      parameters = params;
-    } else if (typeof params === "object") {
-      // Resolve parameter index for named parameter
-      for (const key of Object.keys(params)) {
-        let name = key;
-        // blank names default to ':'
-        if (name[0] !== ":" && name[0] !== "@" && name[0] !== "$") {
-          name = `:${name}`;
-        }
-        const idx = setStr(
-          this.#wasm,
-          name,
-          (ptr) => this.#wasm.bind_parameter_index(this.#stmt, ptr),
-        );
-        if (idx === Values.Error) {
-          throw new SqliteError(`No parameter named '${name}'.`);
-        }
-        parameters[idx - 1] = params[key];
-      }
-    }
+    const parameters = this.#parameterArray(params);
 
     // Bind parameters
     for (let i = 0; i < parameters.length; i++) {
@@ -244,13 +339,16 @@ export class PreparedQuery<
               (ptr) => this.#wasm.bind_text(this.#stmt, i + 1, ptr),
             );
           } else if (value instanceof Uint8Array) {
-            // Uint8Arrays are allowed and bound to BLOB
+            // Uint8Arrays are allowed and bound to BLOB. The copy is
+            // handed over to SQLite, see `bind_blob`. SQLite returns
+            // NULL for empty allocations, which would bind NULL.
             const size = value.length;
-            status = setArr(
-              this.#wasm,
-              value,
-              (ptr) => this.#wasm.bind_blob(this.#stmt, i + 1, ptr, size),
-            );
+            const ptr = this.#wasm.sqlite_malloc(Math.max(size, 1));
+            if (ptr === Values.Null) {
+              throw new SqliteError("Out of memory.", Status.SqliteNoMem);
+            }
+            new Uint8Array(this.#wasm.memory.buffer, ptr, size).set(value);
+            status = this.#wasm.bind_blob(this.#stmt, i + 1, ptr, size);
           } else if (value === null || value === undefined) {
             // Both null and undefined result in a NULL entry
             status = this.#wasm.bind_null(this.#stmt, i + 1);
@@ -265,55 +363,26 @@ export class PreparedQuery<
     }
   }
 
-  #getQueryRow(): R {
+  #fetchRows(maxRows: number): Array<R> {
     if (this.#finalized) {
       throw new SqliteError("Query is finalized.");
     }
 
-    const columnCount = this.#wasm.column_count(this.#stmt);
-    const row: Row = new Array(columnCount);
-    for (let columnIdx = 0; columnIdx < columnCount; columnIdx++) {
-      switch (this.#wasm.column_type(this.#stmt, columnIdx)) {
-        case Types.Integer:
-          row[columnIdx] = this.#wasm.column_int(this.#stmt, columnIdx);
-          break;
-        case Types.Float:
-          row[columnIdx] = this.#wasm.column_double(this.#stmt, columnIdx);
-          break;
-        case Types.Text:
-          row[columnIdx] = getStr(
-            this.#wasm,
-            this.#wasm.column_text(this.#stmt, columnIdx),
-          );
-          break;
-        case Types.Blob: {
-          const ptr = this.#wasm.column_blob(this.#stmt, columnIdx);
-          if (ptr === 0) {
-            // Zero pointer results in null
-            row[columnIdx] = null;
-          } else {
-            const length = this.#wasm.column_bytes(this.#stmt, columnIdx);
-            // Slice should copy the bytes, as it makes a shallow copy
-            row[columnIdx] = new Uint8Array(
-              this.#wasm.memory.buffer,
-              ptr,
-              length,
-            ).slice();
-          }
-          break;
-        }
-        case Types.BigInteger: {
-          const ptr = this.#wasm.column_text(this.#stmt, columnIdx);
-          row[columnIdx] = BigInt(getStr(this.#wasm, ptr));
-          break;
-        }
-        default:
-          // TODO(dyedgreen): Differentiate between NULL and not-recognized?
-          row[columnIdx] = null;
-          break;
-      }
+    // Step through up to `maxRows` rows in a single call, see
+    // `step_rows` in `wrapper.c` for the buffer format.
+    const rowCount = this.#wasm.step_rows(this.#stmt, maxRows);
+    this.#status = this.#wasm.get_status();
+    if (rowCount === 0) {
+      return [];
     }
-    return row as R;
+
+    const columnCount = this.#wasm.column_count(this.#stmt);
+    return getRows(
+      this.#wasm.memory.buffer,
+      this.#wasm.row_buffer(),
+      rowCount,
+      columnCount,
+    ) as Array<R>;
   }
 
   #makeRowObject(row: Row): O {
@@ -376,8 +445,9 @@ export class PreparedQuery<
    */
   iter(params?: P): RowsIterator<R> {
     this.#startQuery(params);
-    this.#status = this.#wasm.step(this.#stmt);
+    this.#rows = this.#fetchRows(ITER_BATCH_ROWS);
     if (
+      this.#rows.length === 0 &&
       this.#status !== Status.SqliteRow && this.#status !== Status.SqliteDone
     ) {
       throw new SqliteError(this.#wasm, this.#status);
@@ -422,9 +492,18 @@ export class PreparedQuery<
    * a bug to call this method directly.
    */
   next(): IteratorResult<R | O> {
-    if (this.#status === Status.SqliteRow) {
-      const value = this.#getQueryRow();
-      this.#status = this.#wasm.step(this.#stmt);
+    if (this.#finalized) {
+      throw new SqliteError("Query is finalized.");
+    }
+    if (
+      this.#rowIdx === this.#rows.length &&
+      this.#status === Status.SqliteRow
+    ) {
+      this.#rows = this.#fetchRows(ITER_BATCH_ROWS);
+      this.#rowIdx = 0;
+    }
+    if (this.#rowIdx < this.#rows.length) {
+      const value = this.#rows[this.#rowIdx++];
       if (this.#iterKv) {
         return { value: this.#makeRowObject(value), done: false };
       } else {
@@ -472,11 +551,9 @@ export class PreparedQuery<
    */
   all(params?: P): Array<R> {
     this.#startQuery(params);
-    const rows: Array<R> = [];
-    this.#status = this.#wasm.step(this.#stmt);
+    const rows = this.#fetchRows(ALL_BATCH_ROWS);
     while (this.#status === Status.SqliteRow) {
-      rows.push(this.#getQueryRow());
-      this.#status = this.#wasm.step(this.#stmt);
+      rows.push(...this.#fetchRows(ALL_BATCH_ROWS));
     }
     if (this.#status !== Status.SqliteDone) {
       throw new SqliteError(this.#wasm, this.#status);
@@ -500,6 +577,38 @@ export class PreparedQuery<
     return this.all(params).map((row) => this.#makeRowObject(row));
   }
 
+  /**
+   * Like `all` except the rows are not decoded, but
+   * returned in the binary format used to move them
+   * out of SQLite. Rows are copied in large batches,
+   * so this is cheap, and the result can be sent to a
+   * worker without cloning each row.
+   *
+   * Use `unpackRows` to decode the result.
+   */
+  allPacked(params?: P): PackedRows {
+    this.#startQuery(params);
+    const columnCount = this.#wasm.column_count(this.#stmt);
+    const packed: PackedRows = { columns: [], batches: [] };
+    for (let i = 0; i < columnCount; i++) {
+      packed.columns.push(
+        getStr(this.#wasm, this.#wasm.column_name(this.#stmt, i)),
+      );
+    }
+    do {
+      const rowCount = this.#wasm.step_rows(this.#stmt, ALL_BATCH_ROWS);
+      this.#status = this.#wasm.get_status();
+      if (rowCount > 0) {
+        const buffer = copyRows(this.#wasm, this.#wasm.row_buffer());
+        packed.batches.push({ rowCount, buffer });
+      }
+    } while (this.#status === Status.SqliteRow);
+    if (this.#status !== Status.SqliteDone) {
+      throw new SqliteError(this.#wasm, this.#status);
+    }
+    return packed;
+  }
+
   /**
    * Binds the given parameters to the query
    * and returns the first resulting row or
@@ -543,11 +652,7 @@ export class PreparedQuery<
   first(params?: P): R | undefined {
     this.#startQuery(params);
 
-    this.#status = this.#wasm.step(this.#stmt);
-    let row = undefined;
-    if (this.#status === Status.SqliteRow) {
-      row = this.#getQueryRow();
-    }
+    const [row] = this.#fetchRows(1);
 
     while (this.#status === Status.SqliteRow) {
       this.#status = this.#wasm.step(this.#stmt);
@@ -636,6 +741,169 @@ export class PreparedQuery<
     }
   }
 
+  /**
+   * Binds each of the given parameter sets to the
+   * query in turn and executes it, ignoring any rows
+   * which might be returned.
+   *
+   * This is equivalent to calling `execute` for every
+   * parameter set, but the parameters are passed to
+   * SQLite in large batches, which makes it considerably
+   * faster for inserting many rows.
+   *
+   * Execution stops at the first parameter set which
+   * fails and the error message includes the index of
+   * that set. Earlier parameter sets remain executed, so
+   * this is typically used within a transaction.
+   *
+   * # Example
+   *
+   * ```typescript
+   * const query = db.prepareQuery<never, never, [string, number]>(
+   *   "INSERT INTO people (name, age) VALUES (?, ?)",
+   * );
+   * db.transaction(() => {
+   *   query.executeMany([["Peter", 21], ["Clark", 33]]);
+   * });
+   * ```
+   *
+   * See `QueryParameterSet` for documentation on
+   * how values can be bound to SQL statements.
+   */
+  executeMany(rows: Iterable<P>) {
+    this.#startQuery();
+
+    let batch: Array<Array<QueryParameter>> = [];
+    let batchBytes = 0;
+    let firstRow = 0;
+    for (const params of rows) {
+      const parameters = this.#parameterArray(params);
+      batch.push(parameters);
+      batchBytes += 4;
+      for (const value of parameters) {
+        if (typeof value === "string") {
+          // UTF-8 needs at most three bytes per UTF-16 code unit
+          batchBytes += 5 + 3 * value.length;
+        } else if (value instanceof Uint8Array) {
+          batchBytes += 5 + value.length;
+        } else if (value instanceof Date) {
+          // ISO 8601 strings have at most 27 ASCII characters
+          batchBytes += 5 + 27;
+        } else {
+          batchBytes += 9;
+        }
+      }
+
+      if (batchBytes >= EXECUTE_BATCH_BYTES) {
+        this.#executeBatch(batch, batchBytes, firstRow);
+        firstRow += batch.length;
+        batch = [];
+        batchBytes = 0;
+      }
+    }
+    if (batch.length > 0) {
+      this.#executeBatch(batch, batchBytes, firstRow);
+    }
+    this.#status = Status.SqliteDone;
+  }
+
+  #executeBatch(
+    batch: Array<Array<QueryParameter>>,
+    maxBytes: number,
+    firstRow: number,
+  ) {
+    const ptr = this.#wasm.malloc(maxBytes);
+    if (ptr === Values.Null) {
+      throw new SqliteError("Out of memory.");
+    }
+
+    try {
+      // Encode parameters, see `execute_batch` in `wrapper.c`
+      // for the buffer format.
+      const view = new DataView(this.#wasm.memory.buffer, ptr, maxBytes);
+      const mem = new Uint8Array(this.#wasm.memory.buffer, ptr, maxBytes);
+      let offset = 0;
+      for (let rowIdx = 0; rowIdx < batch.length; rowIdx++) {
+        const parameters = batch[rowIdx];
+        view.setUint32(offset, parameters.length, true);
+        offset += 4;
+        for (let i = 0; i < parameters.length; i++) {
+          let value = parameters[i];
+          if (value instanceof Date) {
+            // Dates are bound to TEXT, formatted `YYYY-MM-DDTHH:MM:SS.SSSZ`
+            value = value.toISOString();
+          }
+          switch (typeof value) {
+            case "boolean":
+              value = value ? 1 : 0;
+              // fall through
+            case "number":
+              if (Number.isSafeInteger(value)) {
+                view.setUint8(offset, Types.Integer);
+              } else {
+                view.setUint8(offset, Types.Float);
+              }
+              view.setFloat64(offset + 1, value, true);
+              offset += 9;
+              break;
+            case "bigint":
+              if (
+                value > 9223372036854775807n || value < -9223372036854775808n
+              ) {
+                throw new SqliteError(
+                  `BigInt value ${value} overflows 64 bit integer.`,
+                );
+              }
+              view.setUint8(offset, Types.BigInteger);
+              view.setBigInt64(offset + 1, value, true);
+              offset += 9;
+              break;
+            case "string": {
+              const { written } = textEncoder.encodeInto(
+                value,
+                mem.subarray(offset + 5),
+              );
+              view.setUint8(offset, Types.Text);
+              view.setUint32(offset + 1, written, true);
+              offset += 5 + written;
+              break;
+            }
+            default:
+              if (value instanceof Uint8Array) {
+                view.setUint8(offset, Types.Blob);
+                view.setUint32(offset + 1, value.length, true);
+                mem.set(value, offset + 5);
+                offset += 5 + value.length;
+              } else if (value === null || value === undefined) {
+                // Both null and undefined result in a NULL entry
+                view.setUint8(offset, Types.Null);
+                offset += 1;
+              } else {
+                throw new SqliteError(`Can not bind ${typeof value}.`);
+              }
+              break;
+          }
+        }
+      }
+
+      const executed = this.#wasm.execute_batch(
+        this.#stmt,
+        ptr,
+        batch.length,
+      );
+      if (executed < batch.length) {
+        const message = getStr(this.#wasm, this.#wasm.get_sqlite_error_str());
+        this.#status = this.#wasm.get_status();
+        throw new SqliteError(
+          `${message} (parameter set ${firstRow + executed})`,
+          this.#status,
+        );
+      }
+    } finally {
+      this.#wasm.free(ptr);
+    }
+  }
+
   /**
    * Closes the prepared query. This must be
    * called once the query is no longer needed
@@ -643,7 +911,7 @@ export class PreparedQuery<
    *
    * After a prepared query has been finalized,
    * calls to `iter`, `all`, `first`, `execute`,
-   * or `columns` will fail.
+   * `columns`, or `stats` will fail.
    *
    * Using iterators which were previously returned
    * from the finalized query will fail.
@@ -689,6 +957,35 @@ export class PreparedQuery<
     return columns;
   }
 
+  /**
+   * Returns performance statistics for this query,
+   * counted across all runs since it was prepared.
+   *
+   * If `reset` is `true`, the counters are reset after
+   * they were read.
+   */
+  stats(reset = false): QueryStats {
+    if (this.#finalized) {
+      throw new SqliteError("Query is finalized.");
+    }
+
+    const ptr = this.#wasm.stmt_stats(this.#stmt, reset ? 1 : 0);
+    const values = new Float64Array(
+      this.#wasm.memory.buffer,
+      ptr,
+      STMT_STATS_COUNT,
+    );
+    return {
+      fullScanSteps: values[0],
+      sorts: values[1],
+      autoIndexes: values[2],
+      vmSteps: values[3],
+      reprepares: values[4],
+      runs: values[5],
+      memoryUsed: values[6],
+    };
+  }
+
   /**
    * Returns the SQL string used to construct this
    * query, substituting placeholders (e.g. `?`) with
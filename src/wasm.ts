@@ -1,6 +1,16 @@
 import { Wasm } from "../build/sqlite.js";
+import { Types } from "./constants.ts";
 import { SqliteError } from "./error.ts";
 
+// Size of the header written by `step_rows`
+const ROW_HEADER_BYTES = 12;
+// UTF-16 length written by `step_rows` if the text is not valid UTF-8
+const UTF16_INVALID = 0xFFFFFFFF;
+
+// A leading BOM is part of the first value, and is counted
+// in its UTF-16 length, so it must not be stripped
+const textDecoder = new TextDecoder("utf-8", { ignoreBOM: true });
+
 // Move string to C
 export function setStr<T>(
   wasm: Wasm,
@@ -85,3 +95,98 @@ export function getStr(wasm: Wasm, ptr: number): string {
     return str;
   }
 }
+
+// Copy rows packed by C out of WASM memory, so they can
+// be decoded later or transferred to a different thread
+export function copyRows(wasm: Wasm, ptr: number): ArrayBuffer {
+  const header = new DataView(wasm.memory.buffer, ptr, ROW_HEADER_BYTES);
+  const bytes = ROW_HEADER_BYTES + header.getUint32(0, true) +
+    header.getUint32(4, true);
+  return wasm.memory.buffer.slice(ptr, ptr + bytes);
+}
+
+// Read rows packed by C, see `step_rows` in `wrapper.c`
+// for the buffer format. The buffer is either WASM memory
+// or a copy made by `copyRows`.
+export function getRows(
+  buffer: ArrayBuffer,
+  ptr: number,
+  rowCount: number,
+  columnCount: number,
+): Array<Array<unknown>> {
+  const header = new DataView(buffer, ptr, ROW_HEADER_BYTES);
+  const cellBytes = header.getUint32(0, true);
+  const textBytes = header.getUint32(4, true);
+  const textUnits = header.getUint32(8, true);
+
+  const cells = new DataView(
+    buffer,
+    ptr + ROW_HEADER_BYTES,
+    cellBytes,
+  );
+  const textData = new Uint8Array(
+    buffer,
+    ptr + ROW_HEADER_BYTES + cellBytes,
+    textBytes,
+  );
+  // Decode all strings at once. If C found invalid UTF-8, the
+  // decoder's replacement characters could shift or merge across
+  // strings, so we decode each string separately instead.
+  const textExact = textUnits !== UTF16_INVALID;
+  const text = textExact && textBytes > 0 ? textDecoder.decode(textData) : "";
+
+  const rows: Array<Array<unknown>> = new Array(rowCount);
+  let offset = 0;
+  let textOffset = 0;
+  let textIdx = 0;
+  for (let rowIdx = 0; rowIdx < rowCount; rowIdx++) {
+    const row: Array<unknown> = new Array(columnCount);
+    for (let columnIdx = 0; columnIdx < columnCount; columnIdx++) {
+      const type = cells.getUint8(offset);
+      offset += 1;
+      switch (type) {
+        case Types.Integer:
+        case Types.Float:
+          row[columnIdx] = cells.getFloat64(offset, true);
+          offset += 8;
+          break;
+        case Types.BigInteger:
+          row[columnIdx] = cells.getBigInt64(offset, true);
+          offset += 8;
+          break;
+        case Types.Text: {
+          const length = cells.getUint32(offset, true);
+          const units = cells.getUint32(offset + 4, true);
+          offset += 8;
+          if (textExact) {
+            row[columnIdx] = text.slice(textIdx, textIdx + units);
+          } else {
+            row[columnIdx] = textDecoder.decode(
+              textData.subarray(textOffset, textOffset + length),
+            );
+          }
+          textOffset += length;
+          textIdx += units;
+          break;
+        }
+        case Types.Blob: {
+          const length = cells.getUint32(offset, true);
+          offset += 4;
+          // Slice should copy the bytes, as it makes a shallow copy
+          row[columnIdx] = new Uint8Array(
+            buffer,
+            ptr + ROW_HEADER_BYTES + offset,
+            length,
+          ).slice();
+          offset += length;
+          break;
+        }
+        default:
+          row[columnIdx] = null;
+          break;
+      }
+    }
+    rows[rowIdx] = row;
+  }
+  return rows;
+}
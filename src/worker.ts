@@ -0,0 +1,76 @@
+// Worker script used by `AsyncDB`. Each worker owns one
+// connection (and WASM instance), and handles requests in
+// the order they are received.
+
+import { compile } from "../build/sqlite.js";
+import { DB, SqliteOptions } from "./db.ts";
+import { SqliteError } from "./error.ts";
+import { PackedRows, QueryParameterSet } from "./query.ts";
+import { Status } from "./constants.ts";
+
+export type WorkerCall =
+  | { type: "open"; path: string; options: SqliteOptions }
+  | { type: "query"; sql: string; params?: QueryParameterSet }
+  | { type: "execute"; sql: string }
+  | { type: "close" };
+
+export type WorkerRequest = WorkerCall & { id: number };
+
+export type WorkerResponse =
+  | { id: number; rows?: PackedRows; error?: undefined }
+  | { id: number; error: { message: string; code: Status } };
+
+// The module is type checked with the rest of the library,
+// which does not know `self` is a worker
+const scope = self as unknown as {
+  onmessage: (event: MessageEvent<WorkerRequest>) => void;
+  postMessage: (message: WorkerResponse, transfer: Array<ArrayBuffer>) => void;
+};
+
+const ready = compile();
+let db: DB | undefined;
+
+function handle(request: WorkerRequest): WorkerResponse {
+  switch (request.type) {
+    case "open":
+      db = new DB(request.path, request.options);
+      return { id: request.id };
+    case "query": {
+      if (db === undefined) throw new SqliteError("Database was closed.");
+      const rows = db.queryPacked(request.sql, request.params);
+      return { id: request.id, rows };
+    }
+    case "execute":
+      if (db === undefined) throw new SqliteError("Database was closed.");
+      db.execute(request.sql);
+      return { id: request.id };
+    case "close":
+      db?.close(true);
+      db = undefined;
+      return { id: request.id };
+  }
+}
+
+scope.onmessage = async (event: MessageEvent<WorkerRequest>) => {
+  // Messages may arrive before the WASM module is compiled.
+  // Continuations of `ready` run in order, so requests are
+  // still handled in the order they were sent.
+  await ready;
+  const request = event.data;
+  let response: WorkerResponse;
+  try {
+    response = handle(request);
+  } catch (error) {
+    response = {
+      id: request.id,
+      error: error instanceof SqliteError
+        ? { message: error.message, code: error.code }
+        : { message: String(error), code: Status.Unknown },
+    };
+  }
+  // Row buffers are transferred, not cloned
+  const transfer = response.error === undefined
+    ? response.rows?.batches.map(({ buffer }) => buffer) ?? []
+    : [];
+  scope.postMessage(response, transfer);
+};